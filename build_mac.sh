@@ -1 +1,15 @@
-gcc -g3 -ggdb3 src/*.c -o run_tree/cgbemu -Iinclude -Irun_tree/SDL2.framework/Headers -Frun_tree -framework SDL2 && install_name_tool -change @rpath/SDL2.framework/Versions/A/SDL2 @executable_path/SDL2.framework/Versions/A/SDL2 run_tree/cgbemu
+# ./build_mac.sh [debug|release|trace|profile]
+#   debug    (default) symbols, instruction trace from the debugger
+#   release  optimised, tracing compiled out
+#   trace    symbols, every instruction traced
+#   profile  optimised, per opcode and per address execution profile
+case "${1:-debug}" in
+    release) FLAGS="-O2 -DTRACE_LEVEL=0" ;;
+    trace) FLAGS="-g3 -ggdb3 -DTRACE_LEVEL=2" ;;
+    profile) FLAGS="-O2 -g -DTRACE_LEVEL=0 -DPROFILE" ;;
+    *) FLAGS="-g3 -ggdb3 -DTRACE_LEVEL=1" ;;
+esac
+
+gcc $FLAGS src/*.c -o run_tree/cgbemu -Iinclude -Irun_tree/SDL2.framework/Headers -Frun_tree -framework SDL2 && install_name_tool -change @rpath/SDL2.framework/Versions/A/SDL2 @executable_path/SDL2.framework/Versions/A/SDL2 run_tree/cgbemu
+
+gcc -O2 tools/tracediff.c -o run_tree/cgbemu-tracediff
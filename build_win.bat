@@ -1,2 +1,9 @@
+rem build_win.bat [debug|release|trace|profile], see build_mac.sh
+set FLAGS=/DTRACE_LEVEL=1
+if "%1"=="release" set FLAGS=/O2 /DTRACE_LEVEL=0
+if "%1"=="trace" set FLAGS=/DTRACE_LEVEL=2
+if "%1"=="profile" set FLAGS=/O2 /DTRACE_LEVEL=0 /DPROFILE
+
 if not defined VSINSTALLDIR call "C:\Program Files (x86)\Microsoft Visual Studio 14.0\VC\vcvarsall.bat" amd64
-call cl.exe src\*.c /Forun_tree\obj\ /Ferun_tree\cgbemu.exe /Iinclude\ /Iinput\include\ /link input\SDL2.lib
+call cl.exe %FLAGS% src\*.c /Forun_tree\obj\ /Ferun_tree\cgbemu.exe /Iinclude\ /Iinput\include\ /link input\SDL2.lib
+call cl.exe /O2 tools\tracediff.c /Forun_tree\obj\ /Ferun_tree\cgbemu-tracediff.exe
@@ -0,0 +1,19 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Microbenchmarks, run from the command line instead of the emulator.
+
+// audio kernels on one core, scalar against vectorised, in samples per second
+int bench_mix();
+
+// the dispatch loop, line renderer, memory access and the audio chunk, each
+// timed alone on one core and reported as JSON. Takes the main loop so the
+// dispatch number is the real thing
+int bench_micro(int (*emulate)(void*));
+
+// --bench, around system_run: emulated MHz, frames per second, ns per
+// instruction and where the host time went, as JSON
+void bench_begin();
+void bench_report();
+
+#endif
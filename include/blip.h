@@ -0,0 +1,38 @@
+#ifndef BLIP_H
+#define BLIP_H
+
+#include "common.h"
+#include "savestate.h"
+
+// Band-limited step buffer. Callers only record the cycle an amplitude
+// changes at and by how much, each change is added as a band-limited
+// impulse at the matching (fractional) output sample. Reading integrates
+// the impulses back into steps at the output rate, so the cost depends on
+// how many edges there were, not on the clock rate, and nothing aliases.
+//
+// Every sound channel gets its own lane so they can still be panned and
+// mixed after the fact.
+
+#define BLIP_LANES (4)
+
+// how far ahead of the current cycle deltas may be added, in output samples
+#define BLIP_MAX_SAMPLES (4096)
+
+// integrated output is in amplitude units scaled up by this many bits
+#define BLIP_OUTPUT_BITS (6)
+
+void blip_init(double clock_rate, double sample_rate);
+void blip_set_rate(double clock_rate, double sample_rate);
+void blip_add_delta(int lane, u64 cycle, int delta);
+int blip_samples_available(u64 cycle);
+u64 blip_cycle_for_samples(int count);
+void blip_read_samples(u64 cycle, int count, int* out);
+void blip_clear(u64 cycle);
+void blip_serialize(Savestate* state);
+
+// the integration kernel, vectorised where the target allows, and the
+// scalar reference it is benchmarked against
+void blip_integrate(const int* impulses, int count, int* integrators, int* out);
+void blip_integrate_scalar(const int* impulses, int count, int* integrators, int* out);
+
+#endif
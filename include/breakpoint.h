@@ -0,0 +1,55 @@
+#ifndef BREAKPOINT_H
+#define BREAKPOINT_H
+
+#include <stdbool.h>
+
+#include "common.h"
+
+// Breakpoints on PC and watchpoints on memory reads and writes, each with
+// an optional register condition. None of it costs anything until one is
+// set: the main loop only looks PC up in the breakpoint bitmaps while
+// breakpoint_active is set, and a watchpoint flags its 256 byte page in the
+// memory trap tables (see memory.h) so only accesses to that page leave
+// the fast path.
+//
+// A spec is "[bank:]addr [register op value]", all in hex, e.g. "0150",
+// "02:4a20" or "c000 A==3f". Without a bank it matches in any ROM bank.
+// The registers are A F B C D E H L AF BC DE HL SP PC and the ops
+// == != < <= > >=.
+
+#define BREAKPOINT_EXECUTE (0x01)
+#define BREAKPOINT_READ (0x02)
+#define BREAKPOINT_WRITE (0x04)
+
+// why we stopped, on top of the kinds above
+#define BREAKPOINT_STEP (0x08)
+
+#define BREAKPOINT_ANY_BANK (-1)
+
+extern bool breakpoint_active;
+
+// returns the new breakpoint's number, -1 if the spec doesn't parse or
+// there are too many
+int breakpoint_add(int kinds, const char* spec);
+bool breakpoint_remove(int number);
+void breakpoint_clear();
+void breakpoint_list();
+
+// for the gdb stub, which deals in addresses and only ever touches its own
+int breakpoint_add_remote(int kinds, int bank, u16 addr);
+bool breakpoint_remove_remote(int kinds, int bank, u16 addr);
+void breakpoint_clear_remote();
+
+// stop again before the next instruction
+void breakpoint_step();
+
+// main loop, between instructions. Drops into the debugger on a hit
+void breakpoint_check(u16 pc);
+
+// memory slow path, for an access to a watched page. A hit stops once the
+// instruction that made it has finished
+void breakpoint_access(u16 addr, int kind);
+
+#define BREAKPOINT_CHECK(pc) do { if(breakpoint_active) breakpoint_check(pc); } while(0)
+
+#endif
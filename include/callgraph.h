@@ -0,0 +1,40 @@
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+
+#include <stdbool.h>
+
+#include "common.h"
+
+// Guest call graph, part of the PROFILE build (see profile.h). A shadow stack
+// follows CALL, RST and interrupt dispatch down and RET/RETI back up, and
+// every cycle is charged to the path of functions that was on it.
+
+#ifdef PROFILE
+
+// sp is the stack pointer with the return address on it
+void callgraph_call(u16 target, u16 sp);
+void callgraph_interrupt(u16 vector, u16 sp);
+
+// sp is the stack pointer before the return address is popped
+void callgraph_return(u16 sp);
+
+void callgraph_tick(u32 cycles);
+
+// writes <prefix>.folded, collapsed stacks for flame graph tools, and
+// <prefix>.functions, inclusive and exclusive cycles per function. Functions
+// are named from an RGBDS .sym file next to the ROM when there is one
+bool callgraph_write(const char* prefix, const char* rom_path);
+
+#define CALLGRAPH_CALL(target, sp) callgraph_call(target, sp)
+#define CALLGRAPH_INTERRUPT(vector, sp) callgraph_interrupt(vector, sp)
+#define CALLGRAPH_RETURN(sp) callgraph_return(sp)
+
+#else
+
+#define CALLGRAPH_CALL(target, sp) ((void)0)
+#define CALLGRAPH_INTERRUPT(vector, sp) ((void)0)
+#define CALLGRAPH_RETURN(sp) ((void)0)
+
+#endif
+
+#endif
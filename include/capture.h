@@ -0,0 +1,18 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+
+#include "SDL.h"
+
+// Lossless audio capture. Samples are queued by the emulation thread and
+// written out by a background thread in large blocks, so a capture never
+// slows emulation down to disk speed (and never drops, the emulation thread
+// waits instead). A .wav path gets a header, anything else is raw
+// interleaved 16 bit stereo PCM.
+
+bool capture_open(const char* path, int sample_rate);
+void capture_write(const Sint16* samples, int frames);
+void capture_close();
+
+#endif
@@ -36,9 +36,21 @@ Clock cpu_tick_clock;
 Clock cpu_total_clock;
 Registers cpu_registers;
 
+extern const char* const cpu_mnemonics[256];
+extern const char* const cpu_cb_mnemonics[256];
+int cpu_disassemble(const u8* bytes, u16 addr, char* out, int size);
+
 void cpu_do_instruction(u8 opcode);
 void cpu_run_tests();
 
 char cpu_interrupt_master_enable;
+extern char cpu_enable_interrupts_delay;
+
+// instructions executed since power on, counted by the main loop
+extern u64 cpu_instructions;
+
+// jumps to the vector of the highest priority enabled and requested
+// interrupt, returns 0 when nothing was dispatched
+int cpu_service_interrupts();
 
 #endif
@@ -1,11 +1,37 @@
 #ifndef DISPLAY_H
 #define DISPLAY_H
 
+#include "common.h"
+#include "savestate.h"
+
+#define SCREEN_WIDTH (160)
+#define SCREEN_HEIGHT (144)
+
+typedef unsigned int Pixel;
+
+// what the PPU produces, 2 bit colour indexes plus the BG palette each line
+// was drawn with. Only turned into ARGB when something wants to look at it.
+typedef struct {
+    u8 indexes[SCREEN_HEIGHT][SCREEN_WIDTH];
+    u8 palettes[SCREEN_HEIGHT];
+} Frame;
+
+extern Frame* ppu_frame;
+
 int display_init();
 void display_shutdown();
-void display_tick(int clocks);
+void display_write_register(u16 addr, u8 value);
+void display_render_line(u8 line);
+void display_serialize(Savestate* state);
+u64 display_last_frame_hash();
+void display_convert_frame(const Frame* frame, Pixel* out, int pitch);
+void display_present_loop();
+int display_frames_dropped();
+int display_frames_duplicated();
 
 void display_cycle_window_mode();
+void display_toggle_hud();
+void display_invalidate();
 void debug_display();
 
 #endif
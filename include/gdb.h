@@ -0,0 +1,31 @@
+#ifndef GDB_H
+#define GDB_H
+
+#include <stdbool.h>
+
+#include "common.h"
+
+// GDB remote serial protocol stub, so gdb or an IDE frontend can drive the
+// emulator (--gdb <port> on localhost, or --gdb unix:<path>). The listener
+// is polled once per emulated frame and nothing on the instruction path
+// knows about it; breakpoints go through breakpoint.h like any other.
+//
+// Registers are AF BC DE HL SP PC, 16 bits each, which is the start of
+// gdb's own z80 layout so "set architecture z80" works. Addresses above
+// ffff pick a ROM bank for 4000-7fff, bank << 16 | addr, for memory and
+// breakpoints alike. POSIX only, on Windows --gdb just says so.
+
+extern bool gdb_attached;
+
+bool gdb_init(const char* address);
+void gdb_shutdown();
+
+// emulation thread, once per frame. Picks up a new connection (stopping
+// straight away, as gdb expects) or a ctrl-c from the attached one
+void gdb_poll();
+
+// serves packets until gdb continues, steps, detaches or kills us.
+// reason is a BREAKPOINT_* kind, addr the watched address for watchpoints
+void gdb_stop(int reason, u16 addr);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include "common.h"
+
+// FNV-1a, 64 bit. Not cryptographic, just a cheap way to tell whether two
+// runs produced the same bytes
+#define HASH_OFFSET (0xcbf29ce484222325ULL)
+
+u64 hash_bytes(u64 hash, const void* data, int size);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef JOYPAD_H
+#define JOYPAD_H
+
+#include "common.h"
+#include "savestate.h"
+
+// buttons as one byte, set when pressed
+#define JOYPAD_RIGHT  (0x01)
+#define JOYPAD_LEFT   (0x02)
+#define JOYPAD_UP     (0x04)
+#define JOYPAD_DOWN   (0x08)
+#define JOYPAD_A      (0x10)
+#define JOYPAD_B      (0x20)
+#define JOYPAD_SELECT (0x40)
+#define JOYPAD_START  (0x80)
+
+// host thread, whatever is held right now
+void joypad_set_host_buttons(u8 buttons);
+u8 joypad_host_buttons();
+
+// emulation thread, once per frame. The game only sees input change here
+// so it is deterministic for a given frame count (and a movie can stand in
+// for the host)
+void joypad_latch(u8 buttons);
+u8 joypad_buttons();
+
+u8 joypad_read_register();
+void joypad_write_register(u8 value);
+void joypad_serialize(Savestate* state);
+
+#endif
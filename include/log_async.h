@@ -0,0 +1,24 @@
+#ifndef LOG_ASYNC_H
+#define LOG_ASYNC_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+
+// Deferred logging. LOG() calls on any thread copy the format's ID, the
+// raw arguments and the cycle into a ring owned by that thread, and a
+// writer thread does all the formatting and I/O. Strings are copied (up to
+// a limit) so the caller can reuse its buffers straight away.
+//
+// If a thread's ring is full the record is dropped and counted rather than
+// stalling the emulator.
+
+bool log_async_init(const char* path);
+void log_async_shutdown();
+
+// false when the record can't go through the rings (not started, too many
+// threads, a format we can't capture) and should be logged directly
+bool log_async_write(const char* file_name, int line_number, const char* format, va_list args);
+
+int log_async_dropped();
+
+#endif
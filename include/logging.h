@@ -1,15 +1,48 @@
 #ifndef LOGGING_H
 #define LOGGING_H
 
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 void log_with_file_line(const char* file_name, const int line_number, const char* msg, ...);
-void OPLOG(unsigned short opcode, const char* memonic);
-void PCLOG();
 #define LOG(...) log_with_file_line(__FILE__, __LINE__, __VA_ARGS__)
 
-void debug_print_mem();
+// Instruction tracing is chosen at compile time (the build scripts pass
+// -DTRACE_LEVEL), anything below the level compiles to nothing:
+//   0  no tracing
+//   1  trace once switched on from the debugger ('t')
+//   2  trace every instruction from the start
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL 0
+#endif
+
+extern int debug_tick_enabled;
+
+void trace_instruction(unsigned short pc);
+
+#if TRACE_LEVEL >= 2
+#define TRACE_INSTRUCTION(pc) trace_instruction(pc)
+#elif TRACE_LEVEL == 1
+#define TRACE_INSTRUCTION(pc) do { if(debug_tick_enabled) trace_instruction(pc); } while(0)
+#else
+#define TRACE_INSTRUCTION(pc) ((void)0)
+#endif
+
+void debug_print_mem(const char* args);
 void debug_print_cartridge_header();
 
 void debug_tick();
+
+// single stepping from the debugger ('t') rides on the same per-instruction
+// check as level 1 tracing, so a release build doesn't have it
+#if TRACE_LEVEL >= 1
+#define DEBUG_TICK() do { if(debug_tick_enabled) debug_tick(); } while(0)
+#else
+#define DEBUG_TICK() ((void)0)
+#endif
 void debug_break(const char* file_name, const int line_number, const char* function_name);
 #define BREAK debug_break(__FILE__, __LINE__, __FUNCTION__)
 
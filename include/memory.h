@@ -7,9 +7,22 @@
 
 u8 memory[MEMORY_SIZE];
 
+// the ROM bank mapped at 0x4000-0x7fff. There's no MBC yet so it stays 1
+extern u8 mem_rom_bank;
+
+// one entry per 256 byte page, anything set sends reads or writes on that
+// page down the slow path: the IO registers, or a watchpoint on the page
+#define MEM_TRAP_IO (0x01)
+#define MEM_TRAP_WATCH (0x02)
+
+extern u8 mem_read_traps[256];
+extern u8 mem_write_traps[256];
+
 u16 mem_read_u16(u16 addr);
 u8 mem_read_u8(u16 addr);
+u8 mem_read_io(u16 addr);
 void mem_write_u8(u16 addr, u8 value);
+void mem_write_io(u16 addr, u8 value);
 void mem_write_u16(u16 addr, u16 value);
 void mem_set_flag(u16 addr, u8 mask);
 void mem_unset_flag(u16 addr, u8 mask);
@@ -32,7 +45,28 @@ void mem_inc_value(u16 addr);
 #define ADDR_TIMER_CONTROL      (0xff07)
 #define ADDR_INTERRUPT_FLAGS    (0xff0f)
 
-// SOUND GOES IN HERE
+#define ADDR_NR10               (0xff10) // channel 1 sweep
+#define ADDR_NR11               (0xff11) // channel 1 duty / length
+#define ADDR_NR12               (0xff12) // channel 1 envelope
+#define ADDR_NR13               (0xff13) // channel 1 frequency lo
+#define ADDR_NR14               (0xff14) // channel 1 frequency hi / trigger
+#define ADDR_NR21               (0xff16) // channel 2 duty / length
+#define ADDR_NR22               (0xff17) // channel 2 envelope
+#define ADDR_NR23               (0xff18) // channel 2 frequency lo
+#define ADDR_NR24               (0xff19) // channel 2 frequency hi / trigger
+#define ADDR_NR30               (0xff1a) // channel 3 dac on / off
+#define ADDR_NR31               (0xff1b) // channel 3 length
+#define ADDR_NR32               (0xff1c) // channel 3 output level
+#define ADDR_NR33               (0xff1d) // channel 3 frequency lo
+#define ADDR_NR34               (0xff1e) // channel 3 frequency hi / trigger
+#define ADDR_NR41               (0xff20) // channel 4 length
+#define ADDR_NR42               (0xff21) // channel 4 envelope
+#define ADDR_NR43               (0xff22) // channel 4 polynomial counter
+#define ADDR_NR44               (0xff23) // channel 4 trigger
+#define ADDR_NR50               (0xff24) // master volume
+#define ADDR_NR51               (0xff25) // panning
+#define ADDR_NR52               (0xff26) // sound on / off
+#define ADDR_WAVE_RAM           (0xff30) // ends ff3f (16 bytes)
 #define ADDR_LCD_CONTROL        (0xff40)
 #define ADDR_LCD_STATUS         (0xff41)
 #define ADDR_SCROLL_Y           (0xff42)
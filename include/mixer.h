@@ -0,0 +1,19 @@
+#ifndef MIXER_H
+#define MIXER_H
+
+#include "SDL.h"
+#include "common.h"
+
+// Chunk at a time mixing of the four blip lanes down to 16 bit stereo.
+// Panning (NR51) and master volume (NR50) are applied to whole chunks with
+// SSE2 or AVX2 when the compiler targets them, the scalar versions are the
+// reference and are always built so the benchmark can compare against them.
+
+// lanes is count * BLIP_LANES values, mixed gets count interleaved left/right sums
+void mixer_mix(const int* lanes, int count, u8 nr51, u8 nr50, int* mixed);
+void mixer_mix_scalar(const int* lanes, int count, u8 nr51, u8 nr50, int* mixed);
+
+// DC blocking filter over interleaved left/right, levels carries over between chunks
+void mixer_high_pass(int* levels, const int* mixed, int count, Sint16* out);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdbool.h>
+
+#include "common.h"
+
+// Input movies. Every frame's buttons are stored run length encoded, with a
+// savestate keyframe every so often and an index of the keyframes at the
+// end of the file, so playback can start from any frame by loading the
+// keyframe before it and running forward at most one interval.
+//
+// Layout, all little endian:
+//   header    "CGBM", u32 version, u32 keyframe interval (frames), u32 0, u64 rom hash
+//   records   0x01 input run:  u8 buttons, varint frames
+//             0x02 keyframe:   u32 frame, u32 size, savestate
+//   index     u32 count, count * (u32 frame, u64 offset of the keyframe record)
+//   footer    u64 index offset, u32 frames, "CGBE"
+
+bool movie_record(const char* path, int keyframe_interval);
+
+// loads the keyframe at or before start_frame, the caller runs forward from it
+bool movie_play(const char* path, int start_frame);
+
+// emulation thread, once per frame. Records the host buttons when
+// recording, hands back the recorded ones when playing
+u8 movie_input(int frame, u8 buttons);
+
+// emulation thread, once the frame event is done and the state is consistent
+void movie_end_frame(int frame);
+
+bool movie_playing();
+bool movie_finished();
+void movie_close();
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <stdbool.h>
+
+typedef struct {
+    const char* rom_path;
+
+    // no window and no audio device, for CI and batch runs
+    bool headless;
+
+    // stop after this many frames, 0 runs until quit
+    int frames;
+
+    // emulation speed, 1.0 is real time and 0 is uncapped. Negative means
+    // not given: real time with a window, uncapped headless
+    double speed;
+
+    // write the APU output to a file (.wav gets a header, anything else is raw PCM)
+    const char* audio_capture_path;
+
+    // one hash of the audio samples per frame, for diffing builds
+    const char* audio_hash_path;
+
+    // input movies, see movie.h. Playback starts from seek_frame, running
+    // up to it from the nearest keyframe as fast as possible
+    const char* record_path;
+    const char* play_path;
+    int seek_frame;
+    double keyframe_seconds;
+
+    // one hash per frame of the last finished picture and the emulated state
+    const char* frame_hash_path;
+
+    // keep the last trace_entries instructions, written in gameboy-doctor
+    // format to trace_dump_path on exit, crash or the debugger's 'x'. A
+    // trace_stream_path gets every instruction instead
+    int trace_entries;
+    const char* trace_dump_path;
+    const char* trace_stream_path;
+
+    // where a PROFILE build writes its report, <prefix>.txt and <prefix>.flat
+    const char* profile_prefix;
+
+    // Chrome trace_event JSON of what each thread spent its time on
+    const char* timeline_path;
+
+    // key=value performance stats appended every stats_interval seconds
+    const char* stats_path;
+    double stats_interval;
+
+    // --break, --watch, --rwatch and --awatch in the order given, the specs
+    // are parsed by breakpoint_add (see breakpoint.h)
+#define OPTIONS_MAX_BREAKPOINTS (32)
+    const char* breakpoint_specs[OPTIONS_MAX_BREAKPOINTS];
+    int breakpoint_kinds[OPTIONS_MAX_BREAKPOINTS];
+    int breakpoint_count;
+
+    // listen for gdb on this localhost port, or unix:<path>
+    const char* gdb_address;
+
+    // LOG() output, stdout when not given
+    const char* log_path;
+
+    // run the audio kernel benchmark and quit
+    bool bench_mix;
+
+    // --bench <rom>: headless and uncapped, reports timings as JSON on exit
+    // (and to bench_json_path). bench_micro runs the microbenchmarks instead
+    bool bench;
+    bool bench_micro;
+    const char* bench_json_path;
+} Options;
+
+extern Options options;
+
+int options_parse(int argc, char** argv);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef PACING_H
+#define PACING_H
+
+// Holds the emulation thread to real Game Boy speed (59.7275 frames a
+// second), or a multiple of it. Sleeps for most of each frame and only
+// spins for the last bit, so the host is idle between frames.
+
+// 1.0 is real time, 2.0 twice as fast, 0 runs as fast as the host can
+void pacing_init(double speed);
+void pacing_set_speed(double speed);
+
+// emulation thread, at the end of every emulated frame
+void pacing_frame();
+
+// achieved speed over the last second, 1.0 is real time (any thread)
+double pacing_achieved_speed();
+
+// totals since pacing_init
+void pacing_report();
+
+#endif
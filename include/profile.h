@@ -0,0 +1,20 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+
+#include "common.h"
+
+// Execution profile, only built with -DPROFILE (./build_mac.sh profile) so the
+// dispatch loop pays nothing for it otherwise. Counts executions and cycles
+// per opcode, per CB opcode and per guest address, with addresses in the
+// switchable ROM area kept apart for each bank.
+
+// after the instruction at pc has run, its cycles are in cpu_tick_clock
+void profile_instruction(u16 pc, u8 opcode);
+
+// writes <prefix>.txt, a readable report of the opcodes and the 50 hottest
+// addresses, and <prefix>.flat, one tab separated line per address
+bool profile_write(const char* prefix);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include <stdbool.h>
+
+#include "common.h"
+
+// A snapshot of everything the emulation thread owns, enough to carry on
+// from exactly the same cycle. Each module has one serialize function that
+// both saves and loads, so the two directions can't drift apart.
+//
+// Fields are copied as they are in memory, a state is only good for the
+// build (or at least the platform) that made it.
+
+typedef struct {
+    u8* data;
+    int size;
+    int capacity;
+    int position;
+    bool loading;
+    bool failed;
+} Savestate;
+
+// save or load size bytes at data, depending on the direction
+void savestate_field(Savestate* state, void* data, int size);
+#define SAVESTATE_FIELD(state, field) savestate_field((state), &(field), sizeof(field))
+
+// save appends to state->data (grown as needed), load reads from it
+bool savestate_save(Savestate* state);
+bool savestate_load(Savestate* state);
+void savestate_free(Savestate* state);
+
+#endif
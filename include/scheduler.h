@@ -0,0 +1,46 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdbool.h>
+
+#include "common.h"
+#include "savestate.h"
+
+// Every subsystem that needs to do work at a given cycle owns one slot here.
+// The main loop only compares the master clock against scheduler_next_event
+// so nothing runs between events.
+typedef enum {
+    EVENT_PPU,
+    EVENT_APU,
+    EVENT_TIMER,
+    EVENT_FRAME,
+    EVENT_COUNT
+} EventType;
+
+#define EVENT_NEVER (~0ULL)
+
+// callbacks get the cycle the event was due at, not the (later) cycle
+// the instruction that crossed it finished on, so follow up events stay exact
+typedef void (*EventCallback)(u64 cycle);
+
+// master clock in T-cycles (4194304Hz)
+extern u64 scheduler_cycles;
+extern u64 scheduler_next_event;
+
+// callbacks run since power on, for the stats
+extern u64 scheduler_events;
+
+// when set, host time spent in each event's callback is added up in
+// performance counter ticks, for --bench
+extern bool scheduler_timing;
+extern u64 scheduler_event_ticks[EVENT_COUNT];
+
+void scheduler_init();
+void scheduler_register(EventType type, EventCallback callback);
+void scheduler_schedule(EventType type, u64 cycle);
+void scheduler_cancel(EventType type);
+u64 scheduler_event_cycle(EventType type);
+void scheduler_run();
+void scheduler_serialize(Savestate* state);
+
+#endif
@@ -1,9 +1,25 @@
 #ifndef SOUND_H
 #define SOUND_H
 
+#include "common.h"
+#include "savestate.h"
+
+typedef struct {
+    int underruns;
+    int overruns;
+    int buffered;       // frames waiting for the audio device
+    double latency_ms;  // buffered plus one device buffer
+    double rate_adjust; // current resampling nudge, 1.0 is none
+} SoundStats;
+
 int sound_init();
 void sound_shutdown();
-void sound_tick(int clocks);
+void sound_sync();
+void sound_end_frame(int frame);
+void sound_write_register(u16 addr, u8 value);
+u8 sound_read_register(u16 addr);
+void sound_serialize(Savestate* state);
+void sound_get_stats(SoundStats* stats);
 
 #endif
 
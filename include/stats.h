@@ -0,0 +1,39 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+
+// Live performance counters, always collected (two clock reads a frame on
+// the emulation thread) and summed up once an interval into a snapshot.
+// The snapshot is what the F2 overlay shows, and with --stats it's also
+// appended to a file as one line of key=value pairs per interval.
+
+typedef struct {
+    double seconds;             // since stats_init
+    int frame;
+    double speed;               // emulated over host time, 1.0 is real time
+    double fps;
+    double frame_ms_p50;        // host time emulating a frame, pacing excluded
+    double frame_ms_p99;
+    double instructions_per_second;
+    double events_per_second;   // scheduler events
+    int frames_dropped;         // totals since power on
+    int frames_duplicated;
+    int audio_underruns;
+} Stats;
+
+// path may be NULL, then only the overlay gets the numbers
+bool stats_init(const char* path, double interval);
+void stats_shutdown();
+
+// emulation thread, around the emulation of each frame
+void stats_frame_begin();
+void stats_frame_end();
+
+// any thread. Bumped every time a new snapshot is ready, 0 before the first
+int stats_sequence();
+
+// copies the latest snapshot, false if there isn't one yet
+bool stats_get(Stats* out);
+
+#endif
@@ -1,12 +1,19 @@
 #ifndef SYSTEM_H
 #define SYSTEM_H
 
+#include "savestate.h"
+
 // TODO perhaps this should just be hardware init / shutdown?
 // then move audio/graphics out to somewhere else? - psmith march 9th 2017
 
+// frames emulated since power on
+extern int frame_count;
+
 int system_init();
 void system_shutdown();
 void system_tick();
+int system_run(int (*emulate)(void*));
+void system_serialize(Savestate* state);
 
 #endif
 
@@ -0,0 +1,30 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stdbool.h>
+
+// Opt-in timeline of what each thread is doing (--timeline <path>), written
+// on exit as Chrome trace_event JSON for Perfetto or chrome://tracing.
+// Spans are begin/end pairs with a host timestamp, kept in a buffer owned by
+// the thread recording them. While disabled a span costs one flag check.
+//
+// Names have to be string literals, only the pointer is kept.
+
+extern bool timeline_enabled;
+
+bool timeline_init(const char* path);
+
+// names the calling thread in the viewer
+void timeline_thread_name(const char* name);
+
+// 'B'egin, 'E'nd or 'i'nstant
+void timeline_event(const char* name, char phase);
+
+// writes the file, every recording thread has to have finished
+void timeline_shutdown();
+
+#define TIMELINE_BEGIN(name) do { if(timeline_enabled) timeline_event(name, 'B'); } while(0)
+#define TIMELINE_END(name) do { if(timeline_enabled) timeline_event(name, 'E'); } while(0)
+#define TIMELINE_INSTANT(name) do { if(timeline_enabled) timeline_event(name, 'i'); } while(0)
+
+#endif
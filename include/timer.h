@@ -0,0 +1,16 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "common.h"
+#include "savestate.h"
+
+// DIV, TIMA, TMA and TAC (0xff04-0xff07). Nothing is counted per cycle,
+// DIV is worked out from the master clock when read and TIMA overflow is
+// a scheduled event, so the timer costs nothing between accesses.
+
+void timer_init();
+u8 timer_read_register(u16 addr);
+void timer_write_register(u16 addr, u8 value);
+void timer_serialize(Savestate* state);
+
+#endif
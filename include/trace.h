@@ -0,0 +1,37 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+
+#include "common.h"
+
+// One executed instruction: the registers before it ran and the four bytes at
+// PC, everything a gameboy-doctor line needs in 16 bytes
+typedef struct {
+    u8 A, F, B, C, D, E, H, L;
+    u16 SP;
+    u16 PC;
+    u8 pcmem[4];
+} TraceEntry;
+
+// the last trace_ring_mask + 1 instructions, recorded while trace_enabled
+extern TraceEntry* trace_ring;
+extern u32 trace_ring_mask;
+extern u64 trace_position;
+extern bool trace_enabled;
+
+// entries is rounded up to a power of two. With stream_path every entry is
+// also written out as the ring fills, for a full log to diff
+bool trace_init(u32 entries, const char* dump_path, const char* stream_path);
+void trace_shutdown();
+
+void trace_record();
+#define TRACE_RECORD() do { if(trace_enabled) trace_record(); } while(0)
+
+// write the ring oldest first to the dump path, returns false on I/O errors
+bool trace_dump();
+
+// dump the ring on SIGSEGV/SIGABRT/SIGFPE/SIGILL before dying
+void trace_install_crash_handler();
+
+#endif
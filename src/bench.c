@@ -0,0 +1,471 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "SDL.h"
+#include "bench.h"
+#include "blip.h"
+#include "common.h"
+#include "cpu.h"
+#include "display.h"
+#include "logging.h"
+#include "memory.h"
+#include "mixer.h"
+#include "options.h"
+#include "scheduler.h"
+#include "system.h"
+
+// work on chunks the size sound.c flushes in, for long enough to settle
+#define BENCH_CHUNK_SIZE (256)
+#define BENCH_SECONDS (0.5)
+
+// each microbenchmark keeps the best of a few short runs, the least
+// disturbed by whatever else the host is doing
+#define MICRO_REPEATS (15)
+#define MICRO_SECONDS (0.05)
+
+// how far the dispatch loop runs between clock checks, a frame's worth
+#define MICRO_DISPATCH_CYCLES (70224)
+
+#define MICRO_ADDRESSES (4096)
+
+#if defined(__AVX2__)
+#define BENCH_SIMD_NAME "avx2"
+#elif defined(__SSE2__)
+#define BENCH_SIMD_NAME "sse2"
+#else
+#define BENCH_SIMD_NAME "scalar"
+#endif
+
+typedef enum {
+    KERNEL_INTEGRATE_SCALAR,
+    KERNEL_INTEGRATE,
+    KERNEL_MIX_SCALAR,
+    KERNEL_MIX,
+    KERNEL_HIGH_PASS,
+    KERNEL_CHUNK,
+    KERNEL_COUNT
+} BenchKernel;
+
+const char* bench_kernel_names[KERNEL_COUNT] = {
+    "integrate scalar",
+    "integrate simd",
+    "mix scalar",
+    "mix simd",
+    "high pass",
+    "whole chunk",
+};
+
+int bench_impulses[BENCH_CHUNK_SIZE * BLIP_LANES];
+int bench_lanes[BENCH_CHUNK_SIZE * BLIP_LANES];
+int bench_mixed[BENCH_CHUNK_SIZE * 2];
+Sint16 bench_out[BENCH_CHUNK_SIZE * 2];
+int bench_integrators[BLIP_LANES];
+int bench_levels[2];
+
+// every pan and volume setting gets used so no branch pattern is learnt
+u8 bench_nr51 = 0;
+
+void bench_run_kernel(BenchKernel kernel){
+    switch(kernel){
+        case KERNEL_INTEGRATE_SCALAR:
+            blip_integrate_scalar(bench_impulses, BENCH_CHUNK_SIZE, bench_integrators, bench_lanes);
+            break;
+        case KERNEL_INTEGRATE:
+            blip_integrate(bench_impulses, BENCH_CHUNK_SIZE, bench_integrators, bench_lanes);
+            break;
+        case KERNEL_MIX_SCALAR:
+            mixer_mix_scalar(bench_lanes, BENCH_CHUNK_SIZE, bench_nr51++, 0x77, bench_mixed);
+            break;
+        case KERNEL_MIX:
+            mixer_mix(bench_lanes, BENCH_CHUNK_SIZE, bench_nr51++, 0x77, bench_mixed);
+            break;
+        case KERNEL_HIGH_PASS:
+            mixer_high_pass(bench_levels, bench_mixed, BENCH_CHUNK_SIZE, bench_out);
+            break;
+        case KERNEL_CHUNK:
+            blip_integrate(bench_impulses, BENCH_CHUNK_SIZE, bench_integrators, bench_lanes);
+            mixer_mix(bench_lanes, BENCH_CHUNK_SIZE, bench_nr51++, 0x77, bench_mixed);
+            mixer_high_pass(bench_levels, bench_mixed, BENCH_CHUNK_SIZE, bench_out);
+            break;
+        default:
+            break;
+    }
+}
+
+// random impulses the size blip_add_delta leaves behind, which integrate
+// to lane values in the range a real channel puts out
+void bench_fill(){
+    srand(1);
+    for(int i = 0; i < BENCH_CHUNK_SIZE * BLIP_LANES; i++){
+        bench_impulses[i] = (rand() % 2049) - 1024;
+    }
+    memset(bench_integrators, 0, sizeof(bench_integrators));
+    memset(bench_levels, 0, sizeof(bench_levels));
+    blip_integrate_scalar(bench_impulses, BENCH_CHUNK_SIZE, bench_integrators, bench_lanes);
+    bench_nr51 = 0;
+}
+
+// the vectorised kernels have to give exactly what the scalar ones do,
+// captures and hashes are compared across builds
+int bench_check(){
+    static int expected[BENCH_CHUNK_SIZE * BLIP_LANES];
+    int integrators[BLIP_LANES] = {0};
+
+    // an odd count so the scalar tails get checked too
+    int count = BENCH_CHUNK_SIZE - 3;
+
+    bench_fill();
+    memset(bench_integrators, 0, sizeof(bench_integrators));
+    blip_integrate_scalar(bench_impulses, count, integrators, expected);
+    blip_integrate(bench_impulses, count, bench_integrators, bench_lanes);
+    if(memcmp(expected, bench_lanes, count * BLIP_LANES * sizeof(int)) != 0 ||
+       memcmp(integrators, bench_integrators, sizeof(integrators)) != 0){
+        printf("integrate: %s output differs from scalar\n", BENCH_SIMD_NAME);
+        return 0;
+    }
+
+    for(int nr51 = 0; nr51 < 256; nr51++){
+        for(int volume = 0; volume < 8; volume++){
+            u8 nr50 = (u8)((volume << 4) | (7 - volume));
+            mixer_mix_scalar(bench_lanes, count, (u8)nr51, nr50, expected);
+            mixer_mix(bench_lanes, count, (u8)nr51, nr50, bench_mixed);
+            if(memcmp(expected, bench_mixed, count * 2 * sizeof(int)) != 0){
+                printf("mix: %s output differs from scalar (NR51 %02x NR50 %02x)\n", BENCH_SIMD_NAME, nr51, nr50);
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+int bench_mix(){
+    if(!bench_check()) return 0;
+
+    double frequency = (double)SDL_GetPerformanceFrequency();
+    u64 checksum = 0;
+
+    printf("audio kernels, %s build, %d sample chunks, one core\n", BENCH_SIMD_NAME, BENCH_CHUNK_SIZE);
+
+    for(int kernel = 0; kernel < KERNEL_COUNT; kernel++){
+        bench_fill();
+
+        u64 chunks = 0;
+        u64 start = SDL_GetPerformanceCounter();
+        u64 end = start + (u64)(BENCH_SECONDS * frequency);
+        u64 now = start;
+
+        // check the clock every so often rather than every chunk
+        while(now < end){
+            for(int i = 0; i < 64; i++){
+                bench_run_kernel((BenchKernel)kernel);
+            }
+            chunks += 64;
+            now = SDL_GetPerformanceCounter();
+        }
+
+        double seconds = (now - start) / frequency;
+        double rate = chunks * BENCH_CHUNK_SIZE / seconds;
+        printf("  %-20s %8.1f Msamples/s  %8.0fx realtime at 44100Hz\n",
+               bench_kernel_names[kernel], rate / 1e6, rate / 44100);
+
+        checksum += bench_lanes[0] + bench_mixed[1] + bench_out[0];
+    }
+
+    // keeps the results live
+    printf("  checksum %llx\n", checksum);
+    return 1;
+}
+
+// JSON for everything --bench and --bench-micro print
+
+void bench_json_string(FILE* file, const char* value){
+    fputc('"', file);
+    for(; value && *value; value++){
+        unsigned char c = (unsigned char)*value;
+        if(c == '"' || c == '\\') fprintf(file, "\\%c", c);
+        else if(c < 0x20) fprintf(file, "\\u%04x", c);
+        else fputc(c, file);
+    }
+    fputc('"', file);
+}
+
+void bench_json_build(FILE* file){
+#ifdef PROFILE
+    const char* profile = "true";
+#else
+    const char* profile = "false";
+#endif
+    fprintf(file, "  \"build\": {\"simd\": \"%s\", \"trace_level\": %d, \"profile\": %s},\n",
+            BENCH_SIMD_NAME, TRACE_LEVEL, profile);
+}
+
+// writes to stdout and, when asked, to --bench-json as well
+void bench_output(void (*write)(FILE*)){
+    write(stdout);
+    fflush(stdout);
+
+    if(options.bench_json_path){
+        FILE* file = fopen(options.bench_json_path, "w");
+        if(!file){
+            printf("Unable to open %s for the benchmark results\n", options.bench_json_path);
+            return;
+        }
+        write(file);
+        fclose(file);
+    }
+}
+
+// --bench
+
+u64 bench_start_ticks;
+u64 bench_end_ticks;
+u64 bench_start_instructions;
+u64 bench_start_cycles;
+int bench_start_frame;
+
+void bench_begin(){
+    memset(scheduler_event_ticks, 0, sizeof(scheduler_event_ticks));
+    scheduler_timing = true;
+
+    bench_start_instructions = cpu_instructions;
+    bench_start_cycles = scheduler_cycles;
+    bench_start_frame = frame_count;
+    bench_start_ticks = SDL_GetPerformanceCounter();
+}
+
+void bench_write_run(FILE* file){
+    double frequency = (double)SDL_GetPerformanceFrequency();
+    double seconds = (bench_end_ticks - bench_start_ticks) / frequency;
+    u64 instructions = cpu_instructions - bench_start_instructions;
+    u64 cycles = scheduler_cycles - bench_start_cycles;
+    int frames = frame_count - bench_start_frame;
+
+    // the timer's events are a few instructions' worth, they stay with the cpu
+    double ppu = scheduler_event_ticks[EVENT_PPU] / frequency;
+    double apu = scheduler_event_ticks[EVENT_APU] / frequency;
+    double host = scheduler_event_ticks[EVENT_FRAME] / frequency;
+    double cpu = seconds - ppu - apu - host;
+    double total = seconds > 0 ? seconds : 1;
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"rom\": ");
+    bench_json_string(file, options.rom_path);
+    fprintf(file, ",\n  \"input\": ");
+    if(options.play_path) bench_json_string(file, options.play_path);
+    else fprintf(file, "null");
+    fprintf(file, ",\n");
+    bench_json_build(file);
+    fprintf(file, "  \"frames\": %d,\n", frames);
+    fprintf(file, "  \"instructions\": %llu,\n", instructions);
+    fprintf(file, "  \"cycles\": %llu,\n", cycles);
+    fprintf(file, "  \"seconds\": %.6f,\n", seconds);
+    fprintf(file, "  \"emulated_mhz\": %.3f,\n", cycles / total / 1e6);
+    fprintf(file, "  \"realtime_speed\": %.3f,\n", cycles / total / 4194304.0);
+    fprintf(file, "  \"fps\": %.2f,\n", frames / total);
+    fprintf(file, "  \"ns_per_instruction\": %.3f,\n", instructions ? seconds * 1e9 / instructions : 0);
+    fprintf(file, "  \"breakdown_seconds\": {\"cpu\": %.6f, \"ppu\": %.6f, \"apu\": %.6f, \"host\": %.6f},\n",
+            cpu, ppu, apu, host);
+    fprintf(file, "  \"breakdown_percent\": {\"cpu\": %.2f, \"ppu\": %.2f, \"apu\": %.2f, \"host\": %.2f}\n",
+            100 * cpu / total, 100 * ppu / total, 100 * apu / total, 100 * host / total);
+    fprintf(file, "}\n");
+}
+
+void bench_report(){
+    bench_end_ticks = SDL_GetPerformanceCounter();
+    scheduler_timing = false;
+    bench_output(bench_write_run);
+}
+
+// --bench-micro
+
+typedef struct {
+    const char* name;
+    const char* unit;
+    u64 (*run)();
+    double ns_per_op;
+} MicroBenchmark;
+
+int (*micro_emulate)(void*);
+u16 micro_addresses[MICRO_ADDRESSES];
+u16 micro_write_addresses[MICRO_ADDRESSES];
+Pixel micro_pixels[SCREEN_WIDTH * SCREEN_HEIGHT];
+volatile u32 micro_sink;
+
+// a loop of the common instruction kinds: ALU, loads, a memory round
+// trip, a call and a jump
+const u8 micro_program[] = {
+    0x3c,             // c000 INC A
+    0x05,             // c001 DEC B
+    0x78,             // c002 LD A, B
+    0x21, 0x00, 0xd0, // c003 LD HL, $d000
+    0x77,             // c006 LD (HL), A
+    0x7e,             // c007 LD A, (HL)
+    0xcd, 0x10, 0xc0, // c008 CALL $c010
+    0x18, 0xf3,       // c00b JR $c000
+    0x00, 0x00, 0x00,
+    0xc9,             // c010 RET
+};
+
+void micro_stop(u64 cycle){
+    (void)cycle;
+    running = 0;
+}
+
+u64 micro_dispatch(){
+    u64 start = cpu_instructions;
+
+    scheduler_schedule(EVENT_FRAME, scheduler_cycles + MICRO_DISPATCH_CYCLES);
+    running = 1;
+    micro_emulate(NULL);
+
+    return cpu_instructions - start;
+}
+
+u64 micro_render_lines(){
+    for(int line = 0; line < SCREEN_HEIGHT; line++){
+        display_render_line((u8)line);
+    }
+    return SCREEN_HEIGHT;
+}
+
+u64 micro_convert_frame(){
+    display_convert_frame(ppu_frame, micro_pixels, SCREEN_WIDTH);
+    return SCREEN_HEIGHT;
+}
+
+u64 micro_memory_read(){
+    u32 sum = 0;
+    for(int i = 0; i < MICRO_ADDRESSES; i++){
+        sum += mem_read_u8(micro_addresses[i]);
+    }
+    micro_sink = sum;
+    return MICRO_ADDRESSES;
+}
+
+u64 micro_memory_write(){
+    for(int i = 0; i < MICRO_ADDRESSES; i++){
+        mem_write_u8(micro_write_addresses[i], (u8)i);
+    }
+    return MICRO_ADDRESSES;
+}
+
+u64 micro_io_read(){
+    static const u16 registers[] = {ADDR_JOYPAD_INFO, ADDR_DIV_REGISTER, ADDR_TIMER_COUNTER, ADDR_LCD_STATUS};
+    u32 sum = 0;
+    for(int i = 0; i < MICRO_ADDRESSES; i++){
+        sum += mem_read_u8(registers[i & 3]);
+    }
+    micro_sink = sum;
+    return MICRO_ADDRESSES;
+}
+
+u64 micro_audio_chunk(){
+    bench_run_kernel(KERNEL_CHUNK);
+    return BENCH_CHUNK_SIZE;
+}
+
+MicroBenchmark micro_benchmarks[] = {
+    {"dispatch", "instruction", micro_dispatch, 0},
+    {"render_line", "line", micro_render_lines, 0},
+    {"convert_line", "line", micro_convert_frame, 0},
+    {"memory_read", "access", micro_memory_read, 0},
+    {"memory_write", "access", micro_memory_write, 0},
+    {"io_read", "access", micro_io_read, 0},
+    {"audio_chunk", "sample", micro_audio_chunk, 0},
+};
+
+#define MICRO_COUNT ((int)(sizeof(micro_benchmarks) / sizeof(micro_benchmarks[0])))
+
+// what the benchmarks work on, the same every run
+void micro_setup(){
+    srand(1);
+
+    // events from init would interrupt the dispatch loop
+    scheduler_init();
+    scheduler_register(EVENT_FRAME, micro_stop);
+
+    memcpy(&memory[0xc000], micro_program, sizeof(micro_program));
+    cpu_registers.PC = 0xc000;
+    cpu_registers.SP = 0xdffe;
+    cpu_interrupt_master_enable = 0;
+
+    // random tiles and maps, background and window both on
+    for(int addr = ADDR_TILE_DATA1; addr < 0xa000; addr++){
+        memory[addr] = (u8)rand();
+    }
+    memory[ADDR_LCD_CONTROL] = 0xb1;
+    memory[ADDR_SCROLL_X] = 3;
+    memory[ADDR_SCROLL_Y] = 5;
+    memory[ADDR_WINDOW_X] = 87;
+    memory[ADDR_WINDOW_Y] = 72;
+    memory[ADDR_BG_PALLETTE] = 0xe4;
+
+    // ROM, VRAM, work RAM and high RAM in a random order
+    static const u16 regions[4][2] = {{0x0000, 0x8000}, {0x8000, 0x2000}, {0xc000, 0x2000}, {0xff80, 0x7f}};
+    for(int i = 0; i < MICRO_ADDRESSES; i++){
+        const u16* region = regions[rand() & 3];
+        micro_addresses[i] = region[0] + rand() % region[1];
+    }
+
+    // writes stay in work RAM clear of micro_program at c000 and the
+    // stack under dffe, so the benchmarks can run in any order
+    for(int i = 0; i < MICRO_ADDRESSES; i++){
+        micro_write_addresses[i] = 0xd000 + rand() % 0x0f00;
+    }
+
+    bench_fill();
+}
+
+double micro_time(const MicroBenchmark* benchmark){
+    double frequency = (double)SDL_GetPerformanceFrequency();
+    double best = 0;
+
+    // one untimed call to warm caches and branch predictors
+    benchmark->run();
+
+    for(int repeat = 0; repeat < MICRO_REPEATS; repeat++){
+        u64 ops = 0;
+        u64 start = SDL_GetPerformanceCounter();
+        u64 end = start + (u64)(MICRO_SECONDS * frequency);
+        u64 now = start;
+
+        while(now < end){
+            ops += benchmark->run();
+            now = SDL_GetPerformanceCounter();
+        }
+
+        double ns = (now - start) / frequency * 1e9 / ops;
+        if(repeat == 0 || ns < best) best = ns;
+    }
+
+    return best;
+}
+
+void bench_write_micro(FILE* file){
+    fprintf(file, "{\n");
+    bench_json_build(file);
+    fprintf(file, "  \"microbenchmarks\": [\n");
+    for(int i = 0; i < MICRO_COUNT; i++){
+        const MicroBenchmark* benchmark = &micro_benchmarks[i];
+        fprintf(file, "    {\"name\": \"%s\", \"unit\": \"%s\", \"ns_per_op\": %.3f, \"mops\": %.3f}%s\n",
+                benchmark->name, benchmark->unit, benchmark->ns_per_op, 1e3 / benchmark->ns_per_op,
+                i + 1 < MICRO_COUNT ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+int bench_micro(int (*emulate)(void*)){
+    if(!bench_check()) return 0;
+
+    micro_emulate = emulate;
+    micro_setup();
+
+    for(int i = 0; i < MICRO_COUNT; i++){
+        micro_benchmarks[i].ns_per_op = micro_time(&micro_benchmarks[i]);
+    }
+
+    bench_output(bench_write_micro);
+    return 1;
+}
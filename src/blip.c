@@ -0,0 +1,186 @@
+#include <math.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "blip.h"
+#include "common.h"
+
+// impulses are spread over BLIP_WIDTH output samples, with BLIP_PHASES
+// precomputed sub-sample offsets
+#define BLIP_WIDTH (16)
+#define BLIP_PHASE_BITS (5)
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS)
+
+#define BLIP_KERNEL_BITS (15)
+#define BLIP_FRACTION_BITS (32)
+
+#define BLIP_BUFFER_SIZE (BLIP_MAX_SAMPLES + BLIP_WIDTH)
+
+#define PI (3.14159265358979323846)
+
+int blip_kernel[BLIP_PHASES][BLIP_WIDTH];
+
+// impulses waiting to be integrated, lanes interleaved per sample
+int blip_buffer[BLIP_BUFFER_SIZE][BLIP_LANES];
+int blip_integrators[BLIP_LANES];
+
+// one past the last sample any impulse has reached, so reads only move what is in use
+int blip_buffer_end = 0;
+
+// output position (32.32 fixed point samples) of cycle blip_time_base,
+// the fraction carries over between reads so the rate is exact
+u64 blip_time_base = 0;
+u64 blip_position_base = 0;
+u64 blip_factor = 0;
+
+void blip_build_kernel(){
+    // windowed sinc cut off a little below nyquist, each phase is the same
+    // impulse shifted by a fraction of a sample
+    const double cutoff = 0.9;
+
+    for(int phase = 0; phase < BLIP_PHASES; phase++){
+        double taps[BLIP_WIDTH];
+        double sum = 0;
+
+        for(int i = 0; i < BLIP_WIDTH; i++){
+            double x = i - (BLIP_WIDTH / 2 - 1) - (double)phase / BLIP_PHASES;
+            double sinc = x == 0 ? 1.0 : sin(PI * x * cutoff) / (PI * x * cutoff);
+            double window = 0.42 + 0.5 * cos(PI * x / (BLIP_WIDTH / 2)) + 0.08 * cos(2 * PI * x / (BLIP_WIDTH / 2));
+            taps[i] = sinc * window;
+            sum += taps[i];
+        }
+
+        // each phase has to add up to exactly one step or the integrators drift
+        int total = 0;
+        for(int i = 0; i < BLIP_WIDTH; i++){
+            blip_kernel[phase][i] = (int)floor(taps[i] / sum * (1 << BLIP_KERNEL_BITS) + 0.5);
+            total += blip_kernel[phase][i];
+        }
+        blip_kernel[phase][BLIP_WIDTH / 2 - 1] += (1 << BLIP_KERNEL_BITS) - total;
+    }
+}
+
+void blip_set_rate(double clock_rate, double sample_rate){
+    blip_factor = (u64)(sample_rate / clock_rate * 4294967296.0);
+}
+
+void blip_init(double clock_rate, double sample_rate){
+    blip_build_kernel();
+    blip_set_rate(clock_rate, sample_rate);
+    blip_clear(0);
+}
+
+void blip_clear(u64 cycle){
+    memset(blip_buffer, 0, sizeof(blip_buffer));
+    memset(blip_integrators, 0, sizeof(blip_integrators));
+    blip_buffer_end = 0;
+    blip_time_base = cycle;
+    blip_position_base = 0;
+}
+
+u64 blip_position(u64 cycle){
+    return blip_position_base + (cycle - blip_time_base) * blip_factor;
+}
+
+void blip_add_delta(int lane, u64 cycle, int delta){
+    u64 position = blip_position(cycle);
+    int index = (int)(position >> BLIP_FRACTION_BITS);
+    int phase = (int)(position >> (BLIP_FRACTION_BITS - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1);
+
+    // nobody has read for far too long, nothing sensible to do but drop it
+    if(index > BLIP_MAX_SAMPLES) return;
+
+    const int* kernel = blip_kernel[phase];
+    for(int i = 0; i < BLIP_WIDTH; i++){
+        blip_buffer[index + i][lane] += kernel[i] * delta;
+    }
+
+    if(index + BLIP_WIDTH > blip_buffer_end){
+        blip_buffer_end = index + BLIP_WIDTH;
+    }
+}
+
+// samples before the one cycle lands on can't be touched by later deltas
+int blip_samples_available(u64 cycle){
+    int available = (int)(blip_position(cycle) >> BLIP_FRACTION_BITS);
+    return available > BLIP_MAX_SAMPLES ? BLIP_MAX_SAMPLES : available;
+}
+
+// the first cycle at which count samples will be available
+u64 blip_cycle_for_samples(int count){
+    u64 target = (u64)count << BLIP_FRACTION_BITS;
+    if(target <= blip_position_base) return blip_time_base;
+
+    return blip_time_base + (target - blip_position_base + blip_factor - 1) / blip_factor;
+}
+
+void blip_integrate_scalar(const int* impulses, int count, int* integrators, int* out){
+    for(int i = 0; i < count; i++){
+        for(int lane = 0; lane < BLIP_LANES; lane++){
+            integrators[lane] += impulses[i * BLIP_LANES + lane];
+            out[i * BLIP_LANES + lane] = integrators[lane] >> (BLIP_KERNEL_BITS - BLIP_OUTPUT_BITS);
+        }
+    }
+}
+
+// running sum of each lane, the 4 lanes of a sample are exactly one SSE2
+// register so every sample is a single add and shift
+void blip_integrate(const int* impulses, int count, int* integrators, int* out){
+    int i = 0;
+
+#ifdef __SSE2__
+    // a prefix sum over two samples in an AVX2 register puts a lane crossing
+    // shuffle on the dependency chain and measured slower than this
+    __m128i sum = _mm_loadu_si128((const __m128i*)integrators);
+
+    for(; i < count; i++){
+        sum = _mm_add_epi32(sum, _mm_loadu_si128((const __m128i*)&impulses[i * BLIP_LANES]));
+        _mm_storeu_si128((__m128i*)&out[i * BLIP_LANES], _mm_srai_epi32(sum, BLIP_KERNEL_BITS - BLIP_OUTPUT_BITS));
+    }
+
+    _mm_storeu_si128((__m128i*)integrators, sum);
+#endif
+
+    blip_integrate_scalar(&impulses[i * BLIP_LANES], count - i, integrators, &out[i * BLIP_LANES]);
+}
+
+// integrate count samples into out (count * BLIP_LANES values) and move
+// the time base up to cycle, count must be <= blip_samples_available(cycle)
+void blip_read_samples(u64 cycle, int count, int* out){
+    blip_integrate(blip_buffer[0], count, blip_integrators, out);
+
+    // the tails of the last impulses move down to the start
+    if(blip_buffer_end > count){
+        int remaining = blip_buffer_end - count;
+        memmove(blip_buffer, blip_buffer[count], remaining * sizeof(blip_buffer[0]));
+        memset(blip_buffer[remaining], 0, count * sizeof(blip_buffer[0]));
+        blip_buffer_end = remaining;
+    } else {
+        memset(blip_buffer, 0, blip_buffer_end * sizeof(blip_buffer[0]));
+        blip_buffer_end = 0;
+    }
+
+    blip_position_base = blip_position(cycle) - ((u64)count << BLIP_FRACTION_BITS);
+    blip_time_base = cycle;
+}
+
+// only the part of the buffer impulses have reached, the rest is zero
+void blip_serialize(Savestate* state){
+    SAVESTATE_FIELD(state, blip_integrators);
+    SAVESTATE_FIELD(state, blip_buffer_end);
+    SAVESTATE_FIELD(state, blip_time_base);
+    SAVESTATE_FIELD(state, blip_position_base);
+    SAVESTATE_FIELD(state, blip_factor);
+
+    if(state->loading){
+        if(blip_buffer_end < 0 || blip_buffer_end > BLIP_BUFFER_SIZE){
+            state->failed = true;
+            return;
+        }
+        memset(blip_buffer, 0, sizeof(blip_buffer));
+    }
+    savestate_field(state, blip_buffer, blip_buffer_end * sizeof(blip_buffer[0]));
+}
@@ -0,0 +1,389 @@
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "breakpoint.h"
+#include "common.h"
+#include "cpu.h"
+#include "gdb.h"
+#include "logging.h"
+#include "memory.h"
+#include "scheduler.h"
+
+#define BREAKPOINT_MAX (64)
+
+#define BREAKPOINT_BANK_START (0x4000)
+#define BREAKPOINT_BANK_SIZE (0x4000)
+
+typedef enum {
+    CONDITION_NONE,
+    CONDITION_EQUAL,
+    CONDITION_NOT_EQUAL,
+    CONDITION_LESS,
+    CONDITION_LESS_EQUAL,
+    CONDITION_GREATER,
+    CONDITION_GREATER_EQUAL
+} ConditionOp;
+
+typedef struct {
+    const char* name;
+    u8* byte;
+    u16* word;
+} BreakpointRegister;
+
+// pairs first so "AF" isn't read as "A" followed by junk
+const BreakpointRegister breakpoint_registers[] = {
+    {"AF", NULL, &cpu_registers.AF}, {"BC", NULL, &cpu_registers.BC},
+    {"DE", NULL, &cpu_registers.DE}, {"HL", NULL, &cpu_registers.HL},
+    {"SP", NULL, &cpu_registers.SP}, {"PC", NULL, &cpu_registers.PC},
+    {"A", &cpu_registers.A, NULL}, {"F", &cpu_registers.F, NULL},
+    {"B", &cpu_registers.B, NULL}, {"C", &cpu_registers.C, NULL},
+    {"D", &cpu_registers.D, NULL}, {"E", &cpu_registers.E, NULL},
+    {"H", &cpu_registers.H, NULL}, {"L", &cpu_registers.L, NULL},
+};
+
+const char* const condition_ops[] = {NULL, "==", "!=", "<", "<=", ">", ">="};
+
+// likewise "<=" before "<"
+const ConditionOp condition_parse_order[] = {
+    CONDITION_EQUAL, CONDITION_NOT_EQUAL, CONDITION_LESS_EQUAL,
+    CONDITION_GREATER_EQUAL, CONDITION_LESS, CONDITION_GREATER
+};
+
+typedef struct {
+    bool used;
+    bool remote;
+    int kinds;
+    int bank;
+    u16 addr;
+    const BreakpointRegister* reg;
+    ConditionOp op;
+    u16 value;
+} Breakpoint;
+
+bool breakpoint_active = false;
+
+Breakpoint breakpoints[BREAKPOINT_MAX];
+
+// one bit per address for breakpoints that match in any bank, plus one
+// bitmap per ROM bank for the ones tied to a bank, allocated when first used
+u8 breakpoint_bitmap[MEMORY_SIZE / 8];
+u8* breakpoint_bank_bitmaps[256];
+
+bool breakpoint_stepping = false;
+
+// where the step was asked for. gdb stops us from inside scheduler_run,
+// ahead of the check in the same pass, so the step has to wait until the
+// CPU has run something (an instruction or an interrupt dispatch)
+u64 breakpoint_step_cycle = 0;
+
+// a watchpoint hit waiting for its instruction to finish
+int breakpoint_pending = -1;
+int breakpoint_pending_kind = 0;
+u16 breakpoint_pending_addr = 0;
+
+bool breakpoint_banked(u16 addr){
+    return addr >= BREAKPOINT_BANK_START && addr < BREAKPOINT_BANK_START + BREAKPOINT_BANK_SIZE;
+}
+
+bool breakpoint_matches(const Breakpoint* breakpoint, u16 addr){
+    if(breakpoint->addr != addr) return false;
+    if(breakpoint->bank != BREAKPOINT_ANY_BANK && breakpoint_banked(addr) && breakpoint->bank != mem_rom_bank) return false;
+    if(breakpoint->op == CONDITION_NONE) return true;
+
+    u16 value = breakpoint->reg->byte ? *breakpoint->reg->byte : *breakpoint->reg->word;
+    switch(breakpoint->op){
+        case CONDITION_EQUAL: return value == breakpoint->value;
+        case CONDITION_NOT_EQUAL: return value != breakpoint->value;
+        case CONDITION_LESS: return value < breakpoint->value;
+        case CONDITION_LESS_EQUAL: return value <= breakpoint->value;
+        case CONDITION_GREATER: return value > breakpoint->value;
+        case CONDITION_GREATER_EQUAL: return value >= breakpoint->value;
+        default: return true;
+    }
+}
+
+// puts the bitmaps and the memory trap tables back in line with the list
+void breakpoint_rebuild(){
+    memset(breakpoint_bitmap, 0, sizeof(breakpoint_bitmap));
+    for(int bank = 0; bank < 256; bank++){
+        if(breakpoint_bank_bitmaps[bank]){
+            memset(breakpoint_bank_bitmaps[bank], 0, BREAKPOINT_BANK_SIZE / 8);
+        }
+    }
+    for(int page = 0; page < 256; page++){
+        mem_read_traps[page] &= ~MEM_TRAP_WATCH;
+        mem_write_traps[page] &= ~MEM_TRAP_WATCH;
+    }
+
+    breakpoint_active = breakpoint_stepping;
+    for(int i = 0; i < BREAKPOINT_MAX; i++){
+        Breakpoint* breakpoint = &breakpoints[i];
+        if(!breakpoint->used) continue;
+        breakpoint_active = true;
+
+        u16 addr = breakpoint->addr;
+        if(breakpoint->kinds & BREAKPOINT_EXECUTE){
+            if(breakpoint->bank != BREAKPOINT_ANY_BANK && breakpoint_banked(addr)){
+                u16 offset = addr - BREAKPOINT_BANK_START;
+                breakpoint_bank_bitmaps[breakpoint->bank][offset >> 3] |= 1 << (offset & 7);
+            } else {
+                breakpoint_bitmap[addr >> 3] |= 1 << (addr & 7);
+            }
+        }
+        if(breakpoint->kinds & BREAKPOINT_READ) mem_read_traps[addr >> 8] |= MEM_TRAP_WATCH;
+        if(breakpoint->kinds & BREAKPOINT_WRITE) mem_write_traps[addr >> 8] |= MEM_TRAP_WATCH;
+    }
+}
+
+u16 breakpoint_parse_hex(const char** text, bool* ok){
+    char* end;
+    unsigned long value = strtoul(*text, &end, 16);
+    *ok = end != *text && value <= 0xffff;
+    *text = end;
+    return (u16)value;
+}
+
+// register names are matched case insensitively
+bool breakpoint_prefix(const char* text, const char* name){
+    for(; *name; name++, text++){
+        if(toupper((unsigned char)*text) != *name) return false;
+    }
+    return true;
+}
+
+const char* breakpoint_skip_spaces(const char* text){
+    while(*text == ' ' || *text == '\t') text++;
+    return text;
+}
+
+bool breakpoint_parse(const char* spec, Breakpoint* out){
+    const char* text = breakpoint_skip_spaces(spec);
+    bool ok;
+
+    out->bank = BREAKPOINT_ANY_BANK;
+    out->addr = breakpoint_parse_hex(&text, &ok);
+    if(!ok) return false;
+
+    if(*text == ':'){
+        if(out->addr > 0xff) return false;
+        out->bank = out->addr;
+        text++;
+        out->addr = breakpoint_parse_hex(&text, &ok);
+        if(!ok) return false;
+    }
+
+    out->op = CONDITION_NONE;
+    text = breakpoint_skip_spaces(text);
+    if(!*text || *text == '\n') return true;
+
+    out->reg = NULL;
+    for(int i = 0; i < (int)(sizeof(breakpoint_registers) / sizeof(breakpoint_registers[0])); i++){
+        if(breakpoint_prefix(text, breakpoint_registers[i].name)){
+            out->reg = &breakpoint_registers[i];
+            text += strlen(breakpoint_registers[i].name);
+            break;
+        }
+    }
+    if(!out->reg) return false;
+
+    text = breakpoint_skip_spaces(text);
+    for(int i = 0; i < (int)(sizeof(condition_parse_order) / sizeof(condition_parse_order[0])); i++){
+        const char* op = condition_ops[condition_parse_order[i]];
+        if(strncmp(text, op, strlen(op)) == 0){
+            out->op = condition_parse_order[i];
+            text += strlen(op);
+            break;
+        }
+    }
+    if(out->op == CONDITION_NONE) return false;
+
+    text = breakpoint_skip_spaces(text);
+    out->value = breakpoint_parse_hex(&text, &ok);
+    if(!ok) return false;
+
+    text = breakpoint_skip_spaces(text);
+    return !*text || *text == '\n';
+}
+
+int breakpoint_insert(Breakpoint breakpoint){
+    int number = 0;
+    while(number < BREAKPOINT_MAX && breakpoints[number].used) number++;
+    if(number == BREAKPOINT_MAX){
+        printf("No room for more than %d breakpoints\n", BREAKPOINT_MAX);
+        return -1;
+    }
+
+    if(breakpoint.bank != BREAKPOINT_ANY_BANK && !breakpoint_bank_bitmaps[breakpoint.bank]){
+        breakpoint_bank_bitmaps[breakpoint.bank] = calloc(BREAKPOINT_BANK_SIZE / 8, 1);
+        if(!breakpoint_bank_bitmaps[breakpoint.bank]){
+            printf("Failed to allocate the breakpoint bitmap for bank %d\n", breakpoint.bank);
+            return -1;
+        }
+    }
+
+    breakpoint.used = true;
+    breakpoints[number] = breakpoint;
+    breakpoint_rebuild();
+    return number;
+}
+
+int breakpoint_add(int kinds, const char* spec){
+    Breakpoint breakpoint = {0};
+    if(!breakpoint_parse(spec, &breakpoint)){
+        printf("Can't parse breakpoint '%s', expected [bank:]addr [register op value]\n", spec);
+        return -1;
+    }
+
+    breakpoint.kinds = kinds;
+    return breakpoint_insert(breakpoint);
+}
+
+int breakpoint_add_remote(int kinds, int bank, u16 addr){
+    Breakpoint breakpoint = {0};
+    breakpoint.remote = true;
+    breakpoint.kinds = kinds;
+    breakpoint.bank = bank;
+    breakpoint.addr = addr;
+    breakpoint.op = CONDITION_NONE;
+    return breakpoint_insert(breakpoint);
+}
+
+bool breakpoint_remove_remote(int kinds, int bank, u16 addr){
+    for(int i = 0; i < BREAKPOINT_MAX; i++){
+        const Breakpoint* breakpoint = &breakpoints[i];
+        if(!breakpoint->used || !breakpoint->remote) continue;
+        if(breakpoint->kinds == kinds && breakpoint->bank == bank && breakpoint->addr == addr){
+            return breakpoint_remove(i);
+        }
+    }
+    return false;
+}
+
+void breakpoint_clear_remote(){
+    for(int i = 0; i < BREAKPOINT_MAX; i++){
+        if(breakpoints[i].used && breakpoints[i].remote) breakpoints[i].used = false;
+    }
+    breakpoint_pending = -1;
+    breakpoint_rebuild();
+}
+
+void breakpoint_step(){
+    breakpoint_stepping = true;
+    breakpoint_step_cycle = scheduler_cycles;
+    breakpoint_active = true;
+}
+
+bool breakpoint_remove(int number){
+    if(number < 0 || number >= BREAKPOINT_MAX || !breakpoints[number].used) return false;
+
+    breakpoints[number].used = false;
+    if(breakpoint_pending == number) breakpoint_pending = -1;
+    breakpoint_rebuild();
+    return true;
+}
+
+void breakpoint_clear(){
+    memset(breakpoints, 0, sizeof(breakpoints));
+    breakpoint_pending = -1;
+    breakpoint_rebuild();
+}
+
+void breakpoint_list(){
+    bool any = false;
+    for(int i = 0; i < BREAKPOINT_MAX; i++){
+        const Breakpoint* breakpoint = &breakpoints[i];
+        if(!breakpoint->used) continue;
+        any = true;
+
+        const char* kind = "break";
+        if(breakpoint->kinds == BREAKPOINT_WRITE) kind = "watch";
+        if(breakpoint->kinds == BREAKPOINT_READ) kind = "rwatch";
+        if(breakpoint->kinds == (BREAKPOINT_READ | BREAKPOINT_WRITE)) kind = "awatch";
+
+        printf("%2d %-6s %s", i, kind, breakpoint->remote ? "(gdb) " : "");
+        if(breakpoint->bank != BREAKPOINT_ANY_BANK) printf("%02x:", breakpoint->bank);
+        printf("%04x", breakpoint->addr);
+        if(breakpoint->op != CONDITION_NONE){
+            printf(" %s%s%x", breakpoint->reg->name, condition_ops[breakpoint->op], breakpoint->value);
+        }
+        printf("\n");
+    }
+
+    if(!any) printf("No breakpoints\n");
+}
+
+bool breakpoint_bit(u16 pc){
+    if(breakpoint_bitmap[pc >> 3] & (1 << (pc & 7))) return true;
+    if(!breakpoint_banked(pc)) return false;
+
+    const u8* bank = breakpoint_bank_bitmaps[mem_rom_bank];
+    u16 offset = pc - BREAKPOINT_BANK_START;
+    return bank && (bank[offset >> 3] & (1 << (offset & 7)));
+}
+
+// an attached gdb gets every stop, the console debugger otherwise
+void breakpoint_stop(int reason, u16 addr){
+    if(gdb_attached){
+        gdb_stop(reason, addr);
+    } else {
+        BREAK;
+    }
+}
+
+void breakpoint_check(u16 pc){
+    if(breakpoint_pending >= 0){
+        if(!gdb_attached){
+            printf("Watchpoint %d: %s %04x (now %02x), PC %04x\n", breakpoint_pending,
+                   breakpoint_pending_kind == BREAKPOINT_WRITE ? "write to" : "read from",
+                   breakpoint_pending_addr, memory[breakpoint_pending_addr], pc);
+        }
+        // gdb wants the kind of watchpoint, not the kind of access
+        int kinds = breakpoints[breakpoint_pending].kinds;
+        breakpoint_pending = -1;
+        breakpoint_stop(kinds, breakpoint_pending_addr);
+        return;
+    }
+
+    if(breakpoint_stepping){
+        // we only just stopped here, don't stop again before moving
+        if(scheduler_cycles == breakpoint_step_cycle) return;
+
+        breakpoint_stepping = false;
+        breakpoint_rebuild();
+        breakpoint_stop(BREAKPOINT_STEP, pc);
+        return;
+    }
+
+    // the bitmaps keep the list scan off every instruction that isn't a hit
+    if(!breakpoint_bit(pc)) return;
+
+    for(int i = 0; i < BREAKPOINT_MAX; i++){
+        const Breakpoint* breakpoint = &breakpoints[i];
+        if(!breakpoint->used || !(breakpoint->kinds & BREAKPOINT_EXECUTE)) continue;
+        if(!breakpoint_matches(breakpoint, pc)) continue;
+
+        if(!gdb_attached){
+            printf("Breakpoint %d at %02x:%04x\n", i, breakpoint_banked(pc) ? mem_rom_bank : 0, pc);
+        }
+        breakpoint_stop(BREAKPOINT_EXECUTE, pc);
+        return;
+    }
+}
+
+void breakpoint_access(u16 addr, int kind){
+    if(breakpoint_pending >= 0) return;
+
+    for(int i = 0; i < BREAKPOINT_MAX; i++){
+        const Breakpoint* breakpoint = &breakpoints[i];
+        if(!breakpoint->used || !(breakpoint->kinds & kind)) continue;
+        if(!breakpoint_matches(breakpoint, addr)) continue;
+
+        breakpoint_pending = i;
+        breakpoint_pending_kind = kind;
+        breakpoint_pending_addr = addr;
+        return;
+    }
+}
@@ -0,0 +1,376 @@
+#ifdef PROFILE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "callgraph.h"
+#include "common.h"
+#include "memory.h"
+
+#define CALLGRAPH_STACK_MAX (256)
+#define CALLGRAPH_NAME_MAX (80)
+#define CALLGRAPH_ROOT (0)
+#define CALLGRAPH_NONE (0xffffffff)
+
+// one node per distinct path of calls from the root, so the same function
+// called from two places gets two nodes
+typedef struct {
+    u32 function;
+    u32 parent;
+    u32 first_child;
+    u32 next_sibling;
+    u64 calls;
+    u64 self_cycles;
+    u64 total_cycles; // self plus children, only filled in when writing
+} CallgraphNode;
+
+typedef struct {
+    u32 key; // bank << 16 | address
+    u64 calls;
+    u64 inclusive_cycles;
+    u64 exclusive_cycles;
+    u32 on_path; // recursion guard while adding up inclusive cycles
+    char name[CALLGRAPH_NAME_MAX];
+} CallgraphFunction;
+
+typedef struct {
+    u32 key;
+    char* name;
+} CallgraphSymbol;
+
+CallgraphNode* callgraph_nodes = NULL;
+u32 callgraph_node_count = 0;
+u32 callgraph_node_capacity = 0;
+
+CallgraphFunction* callgraph_functions = NULL;
+u32 callgraph_function_count = 0;
+u32 callgraph_function_capacity = 0;
+
+// open addressing from key to function index + 1, 0 is an empty slot
+u32* callgraph_function_table = NULL;
+u32 callgraph_function_table_size = 0;
+
+// the stack pointer each frame's return address was pushed at
+u16 callgraph_stack[CALLGRAPH_STACK_MAX];
+int callgraph_depth = 0;
+u32 callgraph_current = CALLGRAPH_ROOT;
+
+u64 callgraph_dropped_calls = 0;
+u64 callgraph_unmatched_returns = 0;
+
+CallgraphSymbol* callgraph_symbols = NULL;
+int callgraph_symbol_count = 0;
+
+void* callgraph_grow(void* data, u32* capacity, u32 needed, size_t element_size){
+    if(needed <= *capacity) return data;
+
+    u32 new_capacity = *capacity ? *capacity * 2 : 1024;
+    while(new_capacity < needed) new_capacity *= 2;
+
+    data = realloc(data, new_capacity * element_size);
+    if(!data){
+        printf("Failed to grow the call graph to %u entries\n", new_capacity);
+        exit(1);
+    }
+
+    *capacity = new_capacity;
+    return data;
+}
+
+u32 callgraph_hash(u32 key){
+    return (key * 2654435761u) & (callgraph_function_table_size - 1);
+}
+
+void callgraph_rehash(){
+    u32 size = callgraph_function_table_size ? callgraph_function_table_size * 2 : 4096;
+
+    free(callgraph_function_table);
+    callgraph_function_table = calloc(size, sizeof(u32));
+    if(!callgraph_function_table){
+        printf("Failed to allocate the call graph function table\n");
+        exit(1);
+    }
+    callgraph_function_table_size = size;
+
+    for(u32 i = 0; i < callgraph_function_count; i++){
+        u32 slot = callgraph_hash(callgraph_functions[i].key);
+        while(callgraph_function_table[slot]) slot = (slot + 1) & (size - 1);
+        callgraph_function_table[slot] = i + 1;
+    }
+}
+
+u32 callgraph_function(u32 key){
+    if((callgraph_function_count + 1) * 2 > callgraph_function_table_size) callgraph_rehash();
+
+    u32 slot = callgraph_hash(key);
+    while(callgraph_function_table[slot]){
+        u32 index = callgraph_function_table[slot] - 1;
+        if(callgraph_functions[index].key == key) return index;
+        slot = (slot + 1) & (callgraph_function_table_size - 1);
+    }
+
+    callgraph_functions = callgraph_grow(callgraph_functions, &callgraph_function_capacity,
+                                         callgraph_function_count + 1, sizeof(CallgraphFunction));
+    u32 index = callgraph_function_count++;
+    memset(&callgraph_functions[index], 0, sizeof(CallgraphFunction));
+    callgraph_functions[index].key = key;
+    callgraph_function_table[slot] = index + 1;
+    return index;
+}
+
+u32 callgraph_add_node(u32 function, u32 parent){
+    callgraph_nodes = callgraph_grow(callgraph_nodes, &callgraph_node_capacity,
+                                     callgraph_node_count + 1, sizeof(CallgraphNode));
+    u32 index = callgraph_node_count++;
+    CallgraphNode* node = &callgraph_nodes[index];
+    memset(node, 0, sizeof(CallgraphNode));
+    node->function = function;
+    node->parent = parent;
+    node->first_child = CALLGRAPH_NONE;
+    node->next_sibling = CALLGRAPH_NONE;
+
+    if(parent != CALLGRAPH_NONE){
+        node->next_sibling = callgraph_nodes[parent].first_child;
+        callgraph_nodes[parent].first_child = index;
+    }
+    return index;
+}
+
+void callgraph_init(){
+    // the root stands for whatever runs outside of any call
+    callgraph_add_node(CALLGRAPH_NONE, CALLGRAPH_NONE);
+    callgraph_current = CALLGRAPH_ROOT;
+}
+
+void callgraph_tick(u32 cycles){
+    if(!callgraph_nodes) callgraph_init();
+    callgraph_nodes[callgraph_current].self_cycles += cycles;
+}
+
+void callgraph_enter(u16 target, u16 sp){
+    if(!callgraph_nodes) callgraph_init();
+
+    if(callgraph_depth == CALLGRAPH_STACK_MAX){
+        // its cycles stay with the caller, and its return won't match
+        callgraph_dropped_calls++;
+        return;
+    }
+
+    u8 bank = (target >= 0x4000 && target < 0x8000) ? mem_rom_bank : 0;
+    u32 function = callgraph_function(((u32)bank << 16) | target);
+
+    u32 child = callgraph_nodes[callgraph_current].first_child;
+    while(child != CALLGRAPH_NONE && callgraph_nodes[child].function != function){
+        child = callgraph_nodes[child].next_sibling;
+    }
+    if(child == CALLGRAPH_NONE) child = callgraph_add_node(function, callgraph_current);
+
+    callgraph_nodes[child].calls++;
+    callgraph_stack[callgraph_depth++] = sp;
+    callgraph_current = child;
+}
+
+void callgraph_call(u16 target, u16 sp){
+    callgraph_enter(target, sp);
+}
+
+void callgraph_interrupt(u16 vector, u16 sp){
+    callgraph_enter(vector, sp);
+}
+
+void callgraph_return(u16 sp){
+    // a RET above the top frame's return address isn't one of ours, usually
+    // a pushed address used as a jump
+    if(!callgraph_depth || callgraph_stack[callgraph_depth - 1] > sp){
+        callgraph_unmatched_returns++;
+        return;
+    }
+
+    // frames skipped by code that dropped its return address go too
+    while(callgraph_depth && callgraph_stack[callgraph_depth - 1] <= sp){
+        callgraph_depth--;
+        callgraph_current = callgraph_nodes[callgraph_current].parent;
+    }
+}
+
+int callgraph_compare_symbols(const void* a, const void* b){
+    u32 left = ((const CallgraphSymbol*)a)->key;
+    u32 right = ((const CallgraphSymbol*)b)->key;
+    return left < right ? -1 : left > right;
+}
+
+// <rom without its extension>.sym, lines of "bank:address label"
+void callgraph_load_symbols(const char* rom_path){
+    char path[1024];
+    snprintf(path, sizeof(path) - 4, "%s", rom_path);
+
+    char* extension = strrchr(path, '.');
+    char* directory = strrchr(path, '/');
+    if(!directory) directory = strrchr(path, '\\');
+    if(extension && (!directory || extension > directory)) *extension = '\0';
+    strcat(path, ".sym");
+
+    FILE* file = fopen(path, "r");
+    if(!file) return;
+
+    u32 capacity = 0;
+    char line[256];
+    while(fgets(line, sizeof(line), file)){
+        unsigned bank, addr;
+        char name[CALLGRAPH_NAME_MAX];
+
+        if(line[0] == ';') continue;
+        if(sscanf(line, "%x:%x %79s", &bank, &addr, name) != 3) continue;
+
+        callgraph_symbols = callgraph_grow(callgraph_symbols, &capacity,
+                                           callgraph_symbol_count + 1, sizeof(CallgraphSymbol));
+        callgraph_symbols[callgraph_symbol_count].key = ((bank & 0xff) << 16) | (addr & 0xffff);
+        callgraph_symbols[callgraph_symbol_count].name = strdup(name);
+        callgraph_symbol_count++;
+    }
+    fclose(file);
+
+    qsort(callgraph_symbols, callgraph_symbol_count, sizeof(CallgraphSymbol), callgraph_compare_symbols);
+    printf("Loaded %d symbols from %s\n", callgraph_symbol_count, path);
+}
+
+void callgraph_name(u32 key, char* out, int size){
+    static const char* const interrupts[] = {
+        "vblank_interrupt", "lcd_interrupt", "timer_interrupt", "serial_interrupt", "joypad_interrupt"
+    };
+    u8 bank = key >> 16;
+    u16 addr = key & 0xffff;
+
+    // the last symbol at or before the address
+    int low = 0, high = callgraph_symbol_count;
+    while(low < high){
+        int middle = (low + high) / 2;
+        if(callgraph_symbols[middle].key <= key) low = middle + 1;
+        else high = middle;
+    }
+
+    for(int i = low - 1; i >= 0 && (callgraph_symbols[i].key >> 16) == bank; i--){
+        const CallgraphSymbol* symbol = &callgraph_symbols[i];
+        if(symbol->key == key){
+            snprintf(out, size, "%s", symbol->name);
+            return;
+        }
+
+        // local labels only name themselves, count from the function they're in
+        if(strchr(symbol->name, '.')) continue;
+        snprintf(out, size, "%s+$%x", symbol->name, key - symbol->key);
+        return;
+    }
+
+    if(bank == 0 && addr < 0x40 && (addr & 7) == 0){
+        snprintf(out, size, "rst_%02x", addr);
+    } else if(bank == 0 && addr >= 0x40 && addr <= 0x60 && (addr & 7) == 0){
+        snprintf(out, size, "%s", interrupts[(addr - 0x40) / 8]);
+    } else {
+        snprintf(out, size, "%02x:%04x", bank, addr);
+    }
+}
+
+const char* callgraph_node_name(u32 node){
+    if(node == CALLGRAPH_ROOT) return "entry";
+    return callgraph_functions[callgraph_nodes[node].function].name;
+}
+
+// collapsed stacks, and inclusive cycles that count a recursive function once
+void callgraph_walk(FILE* folded, u32 node, char* path, int path_length){
+    CallgraphNode* current = &callgraph_nodes[node];
+    const char* name = callgraph_node_name(node);
+    CallgraphFunction* function = NULL;
+
+    int name_length = (int)strlen(name);
+    if(path_length) path[path_length++] = ';';
+    memcpy(path + path_length, name, name_length + 1);
+    path_length += name_length;
+
+    if(current->self_cycles) fprintf(folded, "%s %llu\n", path, current->self_cycles);
+
+    if(node != CALLGRAPH_ROOT){
+        function = &callgraph_functions[current->function];
+        function->calls += current->calls;
+        function->exclusive_cycles += current->self_cycles;
+        if(!function->on_path) function->inclusive_cycles += current->total_cycles;
+        function->on_path++;
+    }
+
+    for(u32 child = current->first_child; child != CALLGRAPH_NONE; child = callgraph_nodes[child].next_sibling){
+        callgraph_walk(folded, child, path, path_length);
+    }
+
+    if(function) function->on_path--;
+}
+
+int callgraph_compare_functions(const void* a, const void* b){
+    u64 left = ((const CallgraphFunction*)a)->inclusive_cycles;
+    u64 right = ((const CallgraphFunction*)b)->inclusive_cycles;
+    return left < right ? 1 : (left > right ? -1 : 0);
+}
+
+bool callgraph_write(const char* prefix, const char* rom_path){
+    char path[1024];
+    if(!callgraph_nodes) return false;
+
+    callgraph_load_symbols(rom_path);
+    for(u32 i = 0; i < callgraph_function_count; i++){
+        callgraph_name(callgraph_functions[i].key, callgraph_functions[i].name, CALLGRAPH_NAME_MAX);
+    }
+
+    // children always come after their parent
+    for(u32 i = 0; i < callgraph_node_count; i++){
+        callgraph_nodes[i].total_cycles = callgraph_nodes[i].self_cycles;
+    }
+    for(u32 i = callgraph_node_count - 1; i > CALLGRAPH_ROOT; i--){
+        callgraph_nodes[callgraph_nodes[i].parent].total_cycles += callgraph_nodes[i].total_cycles;
+    }
+    u64 total_cycles = callgraph_nodes[CALLGRAPH_ROOT].total_cycles;
+
+    snprintf(path, sizeof(path), "%s.folded", prefix);
+    FILE* folded = fopen(path, "w");
+    if(!folded){
+        printf("Failed to open %s for the call graph\n", path);
+        return false;
+    }
+
+    char* stack_path = malloc((CALLGRAPH_STACK_MAX + 1) * CALLGRAPH_NAME_MAX);
+    if(!stack_path){
+        fclose(folded);
+        return false;
+    }
+    callgraph_walk(folded, CALLGRAPH_ROOT, stack_path, 0);
+    free(stack_path);
+    fclose(folded);
+    printf("Wrote collapsed guest stacks to %s\n", path);
+
+    snprintf(path, sizeof(path), "%s.functions", prefix);
+    FILE* report = fopen(path, "w");
+    if(!report){
+        printf("Failed to open %s for the call graph\n", path);
+        return false;
+    }
+
+    qsort(callgraph_functions, callgraph_function_count, sizeof(CallgraphFunction), callgraph_compare_functions);
+
+    fprintf(report, "%llu cycles, %u functions, %u call paths, %llu calls dropped past depth %d, %llu unmatched returns\n\n",
+            total_cycles, callgraph_function_count, callgraph_node_count - 1,
+            callgraph_dropped_calls, CALLGRAPH_STACK_MAX, callgraph_unmatched_returns);
+    fprintf(report, "%14s %7s %14s %7s %10s  function\n", "inclusive", "%", "exclusive", "%", "calls");
+    for(u32 i = 0; i < callgraph_function_count; i++){
+        const CallgraphFunction* function = &callgraph_functions[i];
+        fprintf(report, "%14llu %6.2f%% %14llu %6.2f%% %10llu  %s\n",
+                function->inclusive_cycles, total_cycles ? 100.0 * function->inclusive_cycles / total_cycles : 0,
+                function->exclusive_cycles, total_cycles ? 100.0 * function->exclusive_cycles / total_cycles : 0,
+                function->calls, function->name);
+    }
+    fclose(report);
+    printf("Wrote guest function cycles to %s\n", path);
+
+    return true;
+}
+
+#endif
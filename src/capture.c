@@ -0,0 +1,174 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "SDL.h"
+#include "capture.h"
+#include "common.h"
+
+// stereo frames queued for the writer, must be a power of two
+#define CAPTURE_RING_SIZE (1 << 16)
+#define CAPTURE_RING_MASK (CAPTURE_RING_SIZE - 1)
+
+// the writer holds off until it has this much, or the capture is closing
+#define CAPTURE_BLOCK_SIZE (16384)
+
+#define WAV_HEADER_SIZE (44)
+
+Sint16 capture_ring[CAPTURE_RING_SIZE * 2];
+SDL_atomic_t capture_head;
+SDL_atomic_t capture_tail;
+SDL_atomic_t capture_closing;
+
+Sint16 capture_block[CAPTURE_BLOCK_SIZE * 2];
+
+FILE* capture_file = NULL;
+SDL_Thread* capture_thread = NULL;
+bool capture_wav = false;
+int capture_rate = 0;
+u64 capture_bytes = 0;
+
+void write_u16_le(u8* out, u16 value){
+    out[0] = value & 0xff;
+    out[1] = value >> 8;
+}
+
+void write_u32_le(u8* out, u32 value){
+    write_u16_le(out, value & 0xffff);
+    write_u16_le(out + 2, value >> 16);
+}
+
+// sizes are patched in once we know them, see capture_close
+void write_wav_header(int sample_rate, u32 data_size){
+    u8 header[WAV_HEADER_SIZE];
+    memcpy(header, "RIFF", 4);
+    write_u32_le(header + 4, WAV_HEADER_SIZE - 8 + data_size);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    write_u32_le(header + 16, 16);
+    write_u16_le(header + 20, 1);               // PCM
+    write_u16_le(header + 22, 2);               // channels
+    write_u32_le(header + 24, sample_rate);
+    write_u32_le(header + 28, sample_rate * 4); // bytes per second
+    write_u16_le(header + 32, 4);               // bytes per frame
+    write_u16_le(header + 34, 16);              // bits per sample
+    memcpy(header + 36, "data", 4);
+    write_u32_le(header + 40, data_size);
+
+    fseek(capture_file, 0, SEEK_SET);
+    fwrite(header, 1, WAV_HEADER_SIZE, capture_file);
+}
+
+// byte order is fixed little endian on disk whatever the host is
+void capture_write_block(int frames){
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+    for(int i = 0; i < frames * 2; i++){
+        capture_block[i] = SDL_Swap16(capture_block[i]);
+    }
+#endif
+
+    fwrite(capture_block, sizeof(Sint16) * 2, frames, capture_file);
+    capture_bytes += frames * sizeof(Sint16) * 2;
+}
+
+int capture_writer(void* unused){
+    while(true){
+        bool closing = SDL_AtomicGet(&capture_closing);
+        int tail = SDL_AtomicGet(&capture_tail);
+        int available = SDL_AtomicGet(&capture_head) - tail;
+
+        if(available < CAPTURE_BLOCK_SIZE && !closing){
+            SDL_Delay(1);
+            continue;
+        }
+
+        if(available == 0) break;
+
+        int count = available < CAPTURE_BLOCK_SIZE ? available : CAPTURE_BLOCK_SIZE;
+        int start = tail & CAPTURE_RING_MASK;
+        int first = count < CAPTURE_RING_SIZE - start ? count : CAPTURE_RING_SIZE - start;
+        memcpy(capture_block, &capture_ring[start * 2], first * sizeof(Sint16) * 2);
+        memcpy(&capture_block[first * 2], capture_ring, (count - first) * sizeof(Sint16) * 2);
+
+        SDL_AtomicSet(&capture_tail, tail + count);
+        capture_write_block(count);
+    }
+
+    return 0;
+}
+
+// emulation thread
+void capture_write(const Sint16* samples, int frames){
+    if(capture_file == NULL) return;
+
+    while(frames > 0){
+        int head = SDL_AtomicGet(&capture_head);
+        int space = CAPTURE_RING_SIZE - (head - SDL_AtomicGet(&capture_tail));
+
+        // the writer is behind, it's a capture so wait rather than drop
+        if(space == 0){
+            SDL_Delay(1);
+            continue;
+        }
+
+        int count = frames < space ? frames : space;
+        int start = head & CAPTURE_RING_MASK;
+        int first = count < CAPTURE_RING_SIZE - start ? count : CAPTURE_RING_SIZE - start;
+        memcpy(&capture_ring[start * 2], samples, first * sizeof(Sint16) * 2);
+        memcpy(capture_ring, &samples[first * 2], (count - first) * sizeof(Sint16) * 2);
+
+        SDL_AtomicSet(&capture_head, head + count);
+        samples += count * 2;
+        frames -= count;
+    }
+}
+
+bool capture_open(const char* path, int sample_rate){
+    capture_file = fopen(path, "wb");
+    if(capture_file == NULL){
+        printf("Unable to open audio capture %s\n", path);
+        return false;
+    }
+
+    // large stdio buffer on top of the block batching
+    setvbuf(capture_file, NULL, _IOFBF, 1 << 20);
+
+    const char* extension = strrchr(path, '.');
+    capture_wav = extension != NULL && SDL_strcasecmp(extension, ".wav") == 0;
+    capture_rate = sample_rate;
+    if(capture_wav){
+        write_wav_header(capture_rate, 0);
+    }
+
+    SDL_AtomicSet(&capture_head, 0);
+    SDL_AtomicSet(&capture_tail, 0);
+    SDL_AtomicSet(&capture_closing, 0);
+    capture_bytes = 0;
+
+    capture_thread = SDL_CreateThread(capture_writer, "audio capture", NULL);
+    if(capture_thread == NULL){
+        printf("Unable to start audio capture thread: %s\n", SDL_GetError());
+        fclose(capture_file);
+        capture_file = NULL;
+        return false;
+    }
+
+    printf("Capturing audio to %s\n", path);
+    return true;
+}
+
+// drains everything queued before closing
+void capture_close(){
+    if(capture_file == NULL) return;
+
+    SDL_AtomicSet(&capture_closing, 1);
+    SDL_WaitThread(capture_thread, NULL);
+    capture_thread = NULL;
+
+    if(capture_wav){
+        u64 limit = 0xffffffffULL - WAV_HEADER_SIZE;
+        write_wav_header(capture_rate, (u32)(capture_bytes < limit ? capture_bytes : limit));
+    }
+
+    fclose(capture_file);
+    capture_file = NULL;
+}
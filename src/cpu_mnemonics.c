@@ -0,0 +1,195 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cpu.h"
+
+// mnemonics for tracing and disassembly, indexed by opcode. NULL is an
+// opcode the CPU doesn't have
+
+const char* const cpu_mnemonics[256] = {
+    /* 00 */ "NOP", "LD BC, d16", "LD (BC), A", "INC BC",
+    /* 04 */ "INC B", "DEC B", "LD B, d8", "RLCA",
+    /* 08 */ "LD (a16), SP", "ADD HL, BC", "LD A, (BC)", "DEC BC",
+    /* 0c */ "INC C", "DEC C", "LD C, d8", "RRCA",
+    /* 10 */ "STOP 0", "LD DE, d16", "LD (DE), A", "INC DE",
+    /* 14 */ "INC D", "DEC D", "LD D, d8", "RLA",
+    /* 18 */ "JR r8", "ADD HL, DE", "LD A, (DE)", "DEC DE",
+    /* 1c */ "INC E", "DEC E", "LD E, d8", "RRA",
+    /* 20 */ "JR NZ, r8", "LD HL, d16", "LD (HL+), A", "INC HL",
+    /* 24 */ "INC H", "DEC H", "LD H, d8", "DAA",
+    /* 28 */ "JR Z, r8", "ADD HL, HL", "LD A, (HL+)", "DEC HL",
+    /* 2c */ "INC L", "DEC L", "LD L, d8", "CPL",
+    /* 30 */ "JR NC, r8", "LD SP, d16", "LD (HL-), A", "INC SP",
+    /* 34 */ "INC (HL)", "DEC (HL)", "LD (HL), d8", "SCF",
+    /* 38 */ "JR C, r8", "ADD HL, SP", "LD A, (HL-)", "DEC SP",
+    /* 3c */ "INC A", "DEC A", "LD A, d8", "CCF",
+    /* 40 */ "LD B, B", "LD B, C", "LD B, D", "LD B, E",
+    /* 44 */ "LD B, H", "LD B, L", "LD B, (HL)", "LD B, A",
+    /* 48 */ "LD C, B", "LD C, C", "LD C, D", "LD C, E",
+    /* 4c */ "LD C, H", "LD C, L", "LD C, (HL)", "LD C, A",
+    /* 50 */ "LD D, B", "LD D, C", "LD D, D", "LD D, E",
+    /* 54 */ "LD D, H", "LD D, L", "LD D, (HL)", "LD D, A",
+    /* 58 */ "LD E, B", "LD E, C", "LD E, D", "LD E, E",
+    /* 5c */ "LD E, H", "LD E, L", "LD E, (HL)", "LD E, A",
+    /* 60 */ "LD H, B", "LD H, C", "LD H, D", "LD H, E",
+    /* 64 */ "LD H, H", "LD H, L", "LD H, (HL)", "LD H, A",
+    /* 68 */ "LD L, B", "LD L, C", "LD L, D", "LD L, E",
+    /* 6c */ "LD L, H", "LD L, L", "LD L, (HL)", "LD L, A",
+    /* 70 */ "LD (HL), B", "LD (HL), C", "LD (HL), D", "LD (HL), E",
+    /* 74 */ "LD (HL), H", "LD (HL), L", "HALT", "LD (HL), A",
+    /* 78 */ "LD A, B", "LD A, C", "LD A, D", "LD A, E",
+    /* 7c */ "LD A, H", "LD A, L", "LD A, (HL)", "LD A, A",
+    /* 80 */ "ADD A, B", "ADD A, C", "ADD A, D", "ADD A, E",
+    /* 84 */ "ADD A, H", "ADD A, L", "ADD A, (HL)", "ADD A, A",
+    /* 88 */ "ADC A, B", "ADC A, C", "ADC A, D", "ADC A, E",
+    /* 8c */ "ADC A, H", "ADC A, L", "ADC A, (HL)", "ADC A, A",
+    /* 90 */ "SUB B", "SUB C", "SUB D", "SUB E",
+    /* 94 */ "SUB H", "SUB L", "SUB (HL)", "SUB A",
+    /* 98 */ "SBC A, B", "SBC A, C", "SBC A, D", "SBC A, E",
+    /* 9c */ "SBC A, H", "SBC A, L", "SBC A, (HL)", "SBC A, A",
+    /* a0 */ "AND B", "AND C", "AND D", "AND E",
+    /* a4 */ "AND H", "AND L", "AND (HL)", "AND A",
+    /* a8 */ "XOR B", "XOR C", "XOR D", "XOR E",
+    /* ac */ "XOR H", "XOR L", "XOR (HL)", "XOR A",
+    /* b0 */ "OR B", "OR C", "OR D", "OR E",
+    /* b4 */ "OR H", "OR L", "OR (HL)", "OR A",
+    /* b8 */ "CP B", "CP C", "CP D", "CP E",
+    /* bc */ "CP H", "CP L", "CP (HL)", "CP A",
+    /* c0 */ "RET NZ", "POP BC", "JP NZ, a16", "JP a16",
+    /* c4 */ "CALL NZ, a16", "PUSH BC", "ADD A, d8", "RST 00H",
+    /* c8 */ "RET Z", "RET", "JP Z, a16", "PREFIX CB",
+    /* cc */ "CALL Z, a16", "CALL a16", "ADC A, d8", "RST 08H",
+    /* d0 */ "RET NC", "POP DE", "JP NC, a16", NULL,
+    /* d4 */ "CALL NC, a16", "PUSH DE", "SUB d8", "RST 10H",
+    /* d8 */ "RET C", "RETI", "JP C, a16", NULL,
+    /* dc */ "CALL C, a16", NULL, "SBC A, d8", "RST 18H",
+    /* e0 */ "LDH (a8), A", "POP HL", "LD (C), A", NULL,
+    /* e4 */ NULL, "PUSH HL", "AND d8", "RST 20H",
+    /* e8 */ "ADD SP, r8", "JP (HL)", "LD (a16), A", NULL,
+    /* ec */ NULL, NULL, "XOR d8", "RST 28H",
+    /* f0 */ "LDH A,(a8)", "POP AF", "LD A, (C)", "DI",
+    /* f4 */ NULL, "PUSH AF", "OR d8", "RST 30H",
+    /* f8 */ "LD HL, SP+r8", "LD SP, HL", "LD A, (a16)", "EI",
+    /* fc */ NULL, NULL, "CP d8", "RST 38H"
+};
+
+// after a 0xcb prefix
+const char* const cpu_cb_mnemonics[256] = {
+    /* 00 */ "RLC B", "RLC C", "RLC D", "RLC E",
+    /* 04 */ "RLC H", "RLC L", "RLC (HL)", "RLC A",
+    /* 08 */ "RRC B", "RRC C", "RRC D", "RRC E",
+    /* 0c */ "RRC H", "RRC L", "RRC (HL)", "RRC A",
+    /* 10 */ "RL B", "RL C", "RL D", "RL E",
+    /* 14 */ "RL H", "RL L", "RL (HL)", "RL A",
+    /* 18 */ "RR B", "RR C", "RR D", "RR E",
+    /* 1c */ "RR H", "RR L", "RR (HL)", "RR A",
+    /* 20 */ "SLA B", "SLA C", "SLA D", "SLA E",
+    /* 24 */ "SLA H", "SLA L", "SLA (HL)", "SLA A",
+    /* 28 */ "SRA B", "SRA C", "SRA D", "SRA E",
+    /* 2c */ "SRA H", "SRA L", "SRA (HL)", "SRA A",
+    /* 30 */ "SWAP B", "SWAP C", "SWAP D", "SWAP E",
+    /* 34 */ "SWAP H", "SWAP L", "SWAP (HL)", "SWAP A",
+    /* 38 */ "SRL B", "SRL C", "SRL D", "SRL E",
+    /* 3c */ "SRL H", "SRL L", "SRL (HL)", "SRL A",
+    /* 40 */ "BIT 0, B", "BIT 0, C", "BIT 0, D", "BIT 0, E",
+    /* 44 */ "BIT 0, H", "BIT 0, L", "BIT 0, (HL)", "BIT 0, A",
+    /* 48 */ "BIT 1, B", "BIT 1, C", "BIT 1, D", "BIT 1, E",
+    /* 4c */ "BIT 1, H", "BIT 1, L", "BIT 1, (HL)", "BIT 1, A",
+    /* 50 */ "BIT 2, B", "BIT 2, C", "BIT 2, D", "BIT 2, E",
+    /* 54 */ "BIT 2, H", "BIT 2, L", "BIT 2, (HL)", "BIT 2, A",
+    /* 58 */ "BIT 3, B", "BIT 3, C", "BIT 3, D", "BIT 3, E",
+    /* 5c */ "BIT 3, H", "BIT 3, L", "BIT 3, (HL)", "BIT 3, A",
+    /* 60 */ "BIT 4, B", "BIT 4, C", "BIT 4, D", "BIT 4, E",
+    /* 64 */ "BIT 4, H", "BIT 4, L", "BIT 4, (HL)", "BIT 4, A",
+    /* 68 */ "BIT 5, B", "BIT 5, C", "BIT 5, D", "BIT 5, E",
+    /* 6c */ "BIT 5, H", "BIT 5, L", "BIT 5, (HL)", "BIT 5, A",
+    /* 70 */ "BIT 6, B", "BIT 6, C", "BIT 6, D", "BIT 6, E",
+    /* 74 */ "BIT 6, H", "BIT 6, L", "BIT 6, (HL)", "BIT 6, A",
+    /* 78 */ "BIT 7, B", "BIT 7, C", "BIT 7, D", "BIT 7, E",
+    /* 7c */ "BIT 7, H", "BIT 7, L", "BIT 7, (HL)", "BIT 7, A",
+    /* 80 */ "RES 0, B", "RES 0, C", "RES 0, D", "RES 0, E",
+    /* 84 */ "RES 0, H", "RES 0, L", "RES 0, (HL)", "RES 0, A",
+    /* 88 */ "RES 1, B", "RES 1, C", "RES 1, D", "RES 1, E",
+    /* 8c */ "RES 1, H", "RES 1, L", "RES 1, (HL)", "RES 1, A",
+    /* 90 */ "RES 2, B", "RES 2, C", "RES 2, D", "RES 2, E",
+    /* 94 */ "RES 2, H", "RES 2, L", "RES 2, (HL)", "RES 2, A",
+    /* 98 */ "RES 3, B", "RES 3, C", "RES 3, D", "RES 3, E",
+    /* 9c */ "RES 3, H", "RES 3, L", "RES 3, (HL)", "RES 3, A",
+    /* a0 */ "RES 4, B", "RES 4, C", "RES 4, D", "RES 4, E",
+    /* a4 */ "RES 4, H", "RES 4, L", "RES 4, (HL)", "RES 4, A",
+    /* a8 */ "RES 5, B", "RES 5, C", "RES 5, D", "RES 5, E",
+    /* ac */ "RES 5, H", "RES 5, L", "RES 5, (HL)", "RES 5, A",
+    /* b0 */ "RES 6, B", "RES 6, C", "RES 6, D", "RES 6, E",
+    /* b4 */ "RES 6, H", "RES 6, L", "RES 6, (HL)", "RES 6, A",
+    /* b8 */ "RES 7, B", "RES 7, C", "RES 7, D", "RES 7, E",
+    /* bc */ "RES 7, H", "RES 7, L", "RES 7, (HL)", "RES 7, A",
+    /* c0 */ "SET 0, B", "SET 0, C", "SET 0, D", "SET 0, E",
+    /* c4 */ "SET 0, H", "SET 0, L", "SET 0, (HL)", "SET 0, A",
+    /* c8 */ "SET 1, B", "SET 1, C", "SET 1, D", "SET 1, E",
+    /* cc */ "SET 1, H", "SET 1, L", "SET 1, (HL)", "SET 1, A",
+    /* d0 */ "SET 2, B", "SET 2, C", "SET 2, D", "SET 2, E",
+    /* d4 */ "SET 2, H", "SET 2, L", "SET 2, (HL)", "SET 2, A",
+    /* d8 */ "SET 3, B", "SET 3, C", "SET 3, D", "SET 3, E",
+    /* dc */ "SET 3, H", "SET 3, L", "SET 3, (HL)", "SET 3, A",
+    /* e0 */ "SET 4, B", "SET 4, C", "SET 4, D", "SET 4, E",
+    /* e4 */ "SET 4, H", "SET 4, L", "SET 4, (HL)", "SET 4, A",
+    /* e8 */ "SET 5, B", "SET 5, C", "SET 5, D", "SET 5, E",
+    /* ec */ "SET 5, H", "SET 5, L", "SET 5, (HL)", "SET 5, A",
+    /* f0 */ "SET 6, B", "SET 6, C", "SET 6, D", "SET 6, E",
+    /* f4 */ "SET 6, H", "SET 6, L", "SET 6, (HL)", "SET 6, A",
+    /* f8 */ "SET 7, B", "SET 7, C", "SET 7, D", "SET 7, E",
+    /* fc */ "SET 7, H", "SET 7, L", "SET 7, (HL)", "SET 7, A"
+};
+
+// the instruction in bytes (at least 3 of them) as it would run from addr,
+// with its operand filled in. Returns the instruction's length
+int cpu_disassemble(const u8* bytes, u16 addr, char* out, int size){
+    u8 opcode = bytes[0];
+    const char* mnemonic = cpu_mnemonics[opcode];
+
+    if(opcode == 0xcb){
+        snprintf(out, size, "%s", cpu_cb_mnemonics[bytes[1]]);
+        return 2;
+    }
+
+    if(!mnemonic){
+        snprintf(out, size, "DB $%02X", opcode);
+        return 1;
+    }
+
+    u16 immediate16 = (u16)(bytes[1] | (bytes[2] << 8));
+    signed char offset = (signed char)bytes[1];
+    char operand[16];
+    const char* placeholder;
+    int placeholder_length = 2;
+    int length = 2;
+
+    if((placeholder = strstr(mnemonic, "d16")) || (placeholder = strstr(mnemonic, "a16"))){
+        snprintf(operand, sizeof(operand), "$%04X", immediate16);
+        placeholder_length = 3;
+        length = 3;
+    } else if((placeholder = strstr(mnemonic, "+r8"))){
+        snprintf(operand, sizeof(operand), "%+d", offset);
+        placeholder_length = 3;
+    } else if((placeholder = strstr(mnemonic, "r8"))){
+        if(strncmp(mnemonic, "JR", 2) == 0){
+            // relative jumps show where they land
+            snprintf(operand, sizeof(operand), "$%04X", (u16)(addr + 2 + offset));
+        } else {
+            // ADD SP, r8 is a signed offset, not a branch
+            snprintf(operand, sizeof(operand), "%d", offset);
+        }
+    } else if((placeholder = strstr(mnemonic, "a8"))){
+        snprintf(operand, sizeof(operand), "$FF%02X", bytes[1]);
+    } else if((placeholder = strstr(mnemonic, "d8"))){
+        snprintf(operand, sizeof(operand), "$%02X", bytes[1]);
+    } else {
+        snprintf(out, size, "%s", mnemonic);
+        return 1;
+    }
+
+    snprintf(out, size, "%.*s%s%s", (int)(placeholder - mnemonic), mnemonic, operand,
+             placeholder + placeholder_length);
+    return length;
+}
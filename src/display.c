@@ -1,34 +1,106 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include "SDL.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "common.h"
+#include "display.h"
+#include "hash.h"
 #include "logging.h"
 #include "memory.h"
+#include "options.h"
+#include "pacing.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "system.h"
+#include "timeline.h"
 
 #define FULL_SCREEN_WIDTH (256)
 #define FULL_SCREEN_HEIGHT (256)
-#define WINDOW_HEIGHT (144)
-#define WINDOW_WIDTH (160)
-#define FRAME_RENDER_CLOCKS (17556)
-#define CLOCKS_PER_LINE (114)
+#define WINDOW_HEIGHT (SCREEN_HEIGHT)
+#define WINDOW_WIDTH (SCREEN_WIDTH)
+
+// all in T-cycles, a line is 456 and a frame 154 lines (70224)
+#define CLOCKS_PER_LINE (456)
+#define OAM_SCAN_CLOCKS (80)
+#define PIXEL_TRANSFER_CLOCKS (172)
+#define HBLANK_CLOCKS (CLOCKS_PER_LINE - OAM_SCAN_CLOCKS - PIXEL_TRANSFER_CLOCKS)
+#define VISIBLE_LINES (144)
+#define TOTAL_LINES (154)
+
+#define PPU_MODE_HBLANK (0)
+#define PPU_MODE_VBLANK (1)
+#define PPU_MODE_OAM_SCAN (2)
+#define PPU_MODE_PIXEL_TRANSFER (3)
+
+#define LCDC_BG_ENABLE (0x01)
+#define LCDC_BG_MAP (0x08)
+#define LCDC_TILE_DATA (0x10)
+#define LCDC_WINDOW_ENABLE (0x20)
+#define LCDC_WINDOW_MAP (0x40)
+#define LCDC_DISPLAY_ENABLE (0x80)
+
+#define TILE_SIZE (16)
+#define TILE_WIDTH (8)
+#define TILE_MAP_WIDTH (32)
+
+// WX is the window position plus 7
+#define WINDOW_X_OFFSET (7)
+
+#define STAT_MODE_MASK (0x03)
+#define STAT_COINCIDENCE (0x04)
+#define STAT_HBLANK_INTERRUPT (0x08)
+#define STAT_VBLANK_INTERRUPT (0x10)
+#define STAT_OAM_INTERRUPT (0x20)
+#define STAT_LYC_INTERRUPT (0x40)
+#define STAT_WRITABLE_MASK (0x78)
 
-#define PIXEL_COUNT (FULL_SCREEN_WIDTH * FULL_SCREEN_HEIGHT)
-#define WINDOW_PIXEL_COUNT (WINDOW_WIDTH * WINDOW_HEIGHT)
 
 SDL_Window* window; 
 SDL_Renderer* renderer;
 SDL_Texture* texture;
 
-int internal_clock = 0;
-u8 prev_horizontal_clock = 0;
-u8 prev_vertical_clock = 0;
+u8 ppu_mode = PPU_MODE_HBLANK;
+bool stat_interrupt_line = false;
+
+// the window keeps its own line counter, it only advances on lines where
+// the window was actually drawn so hiding it mid-frame doesn't skip rows
+u8 window_line = 0;
+bool window_y_triggered = false;
+
+// each tile row byte spread out so bit 7 lands in bits 0-1, bit 6 in 2-3...
+// a row is then (spread[low] | spread[high] << 1) with pixel n at bits 2n
+u16 tile_row_spread[256];
+
+// triple buffered between the emulation and presenter threads. The PPU
+// draws into the back frame, the presenter reads the front frame and the
+// third sits in the middle holding the newest complete frame. Handing a
+// frame over is a single atomic swap with the middle slot, nobody waits.
+#define FRAME_FRESH (0x04)
+#define FRAME_INDEX_MASK (0x03)
+
+Frame frames[3];
+Frame* ppu_frame = &frames[0];
+int back_frame = 0;
+int front_frame = 1;
+SDL_atomic_t middle_frame = {2};
+
+// only written by the emulation / presenter thread respectively, the
+// duplicates are atomic as the stats read them from the emulation thread
+int frames_dropped = 0;
+SDL_atomic_t frames_duplicated;
 
-typedef unsigned int Pixel;
+// the last finished frame, for --frame-hash
+u64 last_frame_hash = HASH_OFFSET;
 
-Pixel window_pixels[WINDOW_PIXEL_COUNT];
-Pixel all_pixels[PIXEL_COUNT];
+// what is currently sitting in the texture, so we only upload lines that changed
+Frame presented_frame;
+bool presented_frame_valid = false;
 
 // 0 = show background
 #define BACKGROUND_DISPLAY_MODE 0
@@ -37,18 +109,100 @@ Pixel all_pixels[PIXEL_COUNT];
 
 int display_mode = BACKGROUND_DISPLAY_MODE;
 
-u8 pick_bit(u8 data, int bit_in, int bit_out){
-    // mask off other bits
-    // shift the bit you wanted to the 0th position
-    // shift it back to the position you wanted
-    u16 masked = (data & (1 << bit_in));
-    return ((masked >> bit_in) << bit_out);
+// the stats overlay (F2), drawn over the picture in window pixels with a
+// 3x5 font. Only redrawn when there is a new snapshot to show
+#define HUD_GLYPH_WIDTH (3)
+#define HUD_GLYPH_HEIGHT (5)
+#define HUD_LINES (4)
+#define HUD_LINE_LENGTH (40)
+#define HUD_MARGIN (2)
+
+// five rows of three pixels, the top row in the high bits
+#define HUD_GLYPH(a, b, c, d, e) ((a) << 12 | (b) << 9 | (c) << 6 | (d) << 3 | (e))
+
+const u16 hud_font[128] = {
+    ['0'] = HUD_GLYPH(7, 5, 5, 5, 7), ['1'] = HUD_GLYPH(2, 6, 2, 2, 7),
+    ['2'] = HUD_GLYPH(7, 1, 7, 4, 7), ['3'] = HUD_GLYPH(7, 1, 3, 1, 7),
+    ['4'] = HUD_GLYPH(5, 5, 7, 1, 1), ['5'] = HUD_GLYPH(7, 4, 7, 1, 7),
+    ['6'] = HUD_GLYPH(7, 4, 7, 5, 7), ['7'] = HUD_GLYPH(7, 1, 1, 2, 2),
+    ['8'] = HUD_GLYPH(7, 5, 7, 5, 7), ['9'] = HUD_GLYPH(7, 5, 7, 1, 7),
+    ['A'] = HUD_GLYPH(2, 5, 7, 5, 5), ['B'] = HUD_GLYPH(6, 5, 6, 5, 6),
+    ['C'] = HUD_GLYPH(3, 4, 4, 4, 3), ['D'] = HUD_GLYPH(6, 5, 5, 5, 6),
+    ['E'] = HUD_GLYPH(7, 4, 6, 4, 7), ['F'] = HUD_GLYPH(7, 4, 6, 4, 4),
+    ['G'] = HUD_GLYPH(3, 4, 5, 5, 3), ['H'] = HUD_GLYPH(5, 5, 7, 5, 5),
+    ['I'] = HUD_GLYPH(7, 2, 2, 2, 7), ['J'] = HUD_GLYPH(1, 1, 1, 5, 2),
+    ['K'] = HUD_GLYPH(5, 5, 6, 5, 5), ['L'] = HUD_GLYPH(4, 4, 4, 4, 7),
+    ['M'] = HUD_GLYPH(5, 7, 7, 5, 5), ['N'] = HUD_GLYPH(6, 5, 5, 5, 5),
+    ['O'] = HUD_GLYPH(2, 5, 5, 5, 2), ['P'] = HUD_GLYPH(6, 5, 6, 4, 4),
+    ['Q'] = HUD_GLYPH(2, 5, 5, 6, 3), ['R'] = HUD_GLYPH(6, 5, 6, 5, 5),
+    ['S'] = HUD_GLYPH(3, 4, 2, 1, 6), ['T'] = HUD_GLYPH(7, 2, 2, 2, 2),
+    ['U'] = HUD_GLYPH(5, 5, 5, 5, 7), ['V'] = HUD_GLYPH(5, 5, 5, 5, 2),
+    ['W'] = HUD_GLYPH(5, 5, 7, 7, 5), ['X'] = HUD_GLYPH(5, 5, 2, 5, 5),
+    ['Y'] = HUD_GLYPH(5, 5, 2, 2, 2), ['Z'] = HUD_GLYPH(7, 1, 2, 4, 7),
+    ['.'] = HUD_GLYPH(0, 0, 0, 0, 2), ['%'] = HUD_GLYPH(5, 1, 2, 4, 5),
+    [':'] = HUD_GLYPH(0, 2, 0, 2, 0), ['/'] = HUD_GLYPH(1, 1, 2, 4, 4),
+    ['-'] = HUD_GLYPH(0, 0, 7, 0, 0),
+};
+
+bool hud_visible = false;
+int hud_sequence = 0;
+SDL_Rect hud_rects[HUD_LINES * HUD_LINE_LENGTH * HUD_GLYPH_WIDTH * HUD_GLYPH_HEIGHT];
+
+void init_tile_row_spread(){
+    for(int value = 0; value < 256; value++){
+        u16 spread = 0;
+        for(int x = 0; x < TILE_WIDTH; x++){
+            if(value & (0x80 >> x)){
+                spread |= 1 << (x * 2);
+            }
+        }
+        tile_row_spread[value] = spread;
+    }
+}
+
+// the one place tile data is decoded, background and window both come through here
+u16 fetch_tile_row(u8 lcdc, u8 tile_idx, u8 row){
+    u16 tile_data_addr;
+
+    if(lcdc & LCDC_TILE_DATA){
+        tile_data_addr = ADDR_TILE_DATA1 + tile_idx * TILE_SIZE;
+    } else {
+        // 0x8800 addressing uses signed indexes around 0x9000
+        tile_data_addr = 0x9000 + ((signed char)tile_idx) * TILE_SIZE;
+    }
+
+    // each row is 2 bytes, the first holds the low bit of every pixel
+    tile_data_addr += row * 2;
+    u8 low = memory[tile_data_addr];
+    u8 high = memory[tile_data_addr + 1];
+
+    return tile_row_spread[low] | (tile_row_spread[high] << 1);
+}
+
+// decode count palette indexes from a 32x32 tile map starting at map pixel (x, y)
+void render_tile_span(u8 lcdc, u16 map_addr, u8 x, u8 y, int count, u8* out){
+    u16 map_row = map_addr + (y / TILE_WIDTH) * TILE_MAP_WIDTH;
+    u8 row = y % TILE_WIDTH;
+    int i = 0;
+
+    while(i < count){
+        u8 tile_idx = memory[map_row + (x / TILE_WIDTH)];
+        u16 pixels = fetch_tile_row(lcdc, tile_idx, row);
+
+        // we may start or finish part way through a tile
+        for(int px = x % TILE_WIDTH; px < TILE_WIDTH && i < count; px++){
+            out[i++] = (pixels >> (px * 2)) & 0x03;
+            x++;
+        }
+    }
+}
+
+u8 apply_palette(u8 palette, u8 palette_idx){
+    return (palette >> (palette_idx * 2)) & 0x03;
 }
 
 Pixel get_bg_pixel(u8 palette_index){
-    // u8 bg_palette = mem_read_u8(ADDR_BG_PALLETTE);
-    // TODO use the actual BG palette instead of our hardcoded shades
-    // we want this function to just return full u8 pixel colors
+    // palette_index is a shade, already passed through the BG palette
     switch(palette_index){
         case 0x00: return 0xffffffff; //bg_palette & 0x03; // 00000011
         case 0x01: return 0xffbbbbbb; //bg_palette & 0x0c; // 00001100
@@ -61,9 +215,9 @@ Pixel get_bg_pixel(u8 palette_index){
 }
 
 void debug_display(){
-    printf("---- Display -----");
-    printf("Internal clock: %d\n", internal_clock);
-    printf("PrevH: %d, PrevV: %d\n", prev_horizontal_clock, prev_vertical_clock);
+    printf("---- Display -----\n");
+    printf("Mode: %d, LY: %d, STAT: 0x%02x\n", ppu_mode, memory[ADDR_LCDY_COORD], memory[ADDR_LCD_STATUS]);
+    printf("Next event: %llu (now %llu)\n", scheduler_event_cycle(EVENT_PPU), scheduler_cycles);
 }
 
 bool is_on_frame_border(u8 x, u8 y){
@@ -93,9 +247,6 @@ bool is_on_frame_border(u8 x, u8 y){
 }
 
 void display_blit_frame(){
-    u8 frame_min_x = mem_read_u16(ADDR_SCROLL_X); 
-    u8 frame_min_y = mem_read_u16(ADDR_SCROLL_Y); 
-
     switch(display_mode)
     {
         case BACKGROUND_DISPLAY_MODE:
@@ -103,9 +254,10 @@ void display_blit_frame(){
             break;
         case ACTUAL_SIZE_DISPLAY_MODE:
             {
+                // the screen is kept in the top left corner of the texture
                 SDL_Rect rect;
-                rect.x = frame_min_x;
-                rect.y = frame_min_y;
+                rect.x = 0;
+                rect.y = 0;
                 rect.w = WINDOW_WIDTH;
                 rect.h = WINDOW_HEIGHT;
                 SDL_RenderCopy(renderer, texture, &rect, NULL);
@@ -117,72 +269,327 @@ void display_blit_frame(){
     }
 }
 
-void render_frame(){
-    u8 TILE_SIZE = 16;
-    u8 TILE_WIDTH = 8;
-    u16 tile_index_base;
-    u16 tile_data_base = ADDR_TILE_DATA1;
-    u16 bg_idx;
-    u16 tile_data_addr;
-    u8 tile_idx;
-    u8 msb;
-    u8 lsb;
-    u8 shift;
-    u8 palette_idx;
-    u16 y;
-    u16 x;
-
-    // for each pixel line
-    for(y = 0; y < FULL_SCREEN_HEIGHT; y++){
-        // where to look for this pixels tile, the tile map is 32 wide
-        // and each tile is 8 pixels e.g.
-        // (0 / 8) * 32 == 0 (first line)
-        // (8 / 8) * 32 == 1 (8th pixel down, start of 2nd tile down)
-        tile_index_base = ADDR_BGMAP1 + (y / TILE_WIDTH) * 32;
-
-        // each line is 2 bytes long so each y we go down, we have to offset 2 more bytes e.g.
-        // (0 % 8) * 2 == 0 (first line data starts at 0)
-        // (4 % 8) * 2 == 8 (4th pixel line starts 8 bytes into tile)
-        tile_data_base = ADDR_TILE_DATA1 + (y % TILE_WIDTH) * (TILE_SIZE / TILE_WIDTH);
-
-        // for each pixel 
-        for(x = 0; x < FULL_SCREEN_WIDTH;  x++)
-        {
-            if(is_on_frame_border(x, y))
-            {
-                all_pixels[(y * FULL_SCREEN_WIDTH) + x] = 0x00;
-                continue;
+// one pixel rect per lit font pixel, returns how many were added
+int hud_text(int x, int y, const char* text, SDL_Rect* rects){
+    int count = 0;
+    for(int i = 0; text[i] && i < HUD_LINE_LENGTH; i++){
+        char c = text[i];
+        if(c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        u16 glyph = (c > 0) ? hud_font[(int)c] : 0;
+
+        for(int row = 0; row < HUD_GLYPH_HEIGHT; row++){
+            for(int column = 0; column < HUD_GLYPH_WIDTH; column++){
+                int bit = (HUD_GLYPH_HEIGHT - 1 - row) * HUD_GLYPH_WIDTH + (HUD_GLYPH_WIDTH - 1 - column);
+                if(glyph & (1 << bit)){
+                    rects[count++] = (SDL_Rect){x + column, y + row, 1, 1};
+                }
+            }
+        }
+        x += HUD_GLYPH_WIDTH + 1;
+    }
+    return count;
+}
+
+// 1234567 as 1.23M, keeps the lines short enough for the 160 pixel window
+void hud_rate(double value, char* out, int size){
+    if(value >= 1e6){
+        snprintf(out, size, "%.2fM", value / 1e6);
+    } else if(value >= 1e3){
+        snprintf(out, size, "%.1fK", value / 1e3);
+    } else {
+        snprintf(out, size, "%.0f", value);
+    }
+}
+
+void draw_hud(){
+    Stats stats;
+    if(!stats_get(&stats)) return;
+
+    char instructions[16];
+    char events[16];
+    hud_rate(stats.instructions_per_second, instructions, sizeof(instructions));
+    hud_rate(stats.events_per_second, events, sizeof(events));
+
+    char lines[HUD_LINES][64];
+    snprintf(lines[0], sizeof(lines[0]), "SPEED %.1f%% %.1f FPS", stats.speed * 100, stats.fps);
+    snprintf(lines[1], sizeof(lines[1]), "FRAME P50 %.2f P99 %.2f MS", stats.frame_ms_p50, stats.frame_ms_p99);
+    snprintf(lines[2], sizeof(lines[2]), "INSTR %s/S EVENTS %s/S", instructions, events);
+    snprintf(lines[3], sizeof(lines[3]), "DROP %d DUP %d UNDERRUN %d",
+             stats.frames_dropped, stats.frames_duplicated, stats.audio_underruns);
+
+    int count = 0;
+    int width = 0;
+    for(int i = 0; i < HUD_LINES; i++){
+        int length = (int)strlen(lines[i]);
+        if(length > width) width = length;
+        count += hud_text(HUD_MARGIN, HUD_MARGIN + i * (HUD_GLYPH_HEIGHT + 1), lines[i], &hud_rects[count]);
+    }
+
+    // darken behind the text so it reads over any picture
+    SDL_Rect backdrop = {0, 0, width * (HUD_GLYPH_WIDTH + 1) + HUD_MARGIN * 2 - 1,
+                         HUD_LINES * (HUD_GLYPH_HEIGHT + 1) + HUD_MARGIN * 2 - 1};
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0xa0);
+    SDL_RenderFillRect(renderer, &backdrop);
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+
+    SDL_SetRenderDrawColor(renderer, 0xff, 0xff, 0xff, 0xff);
+    SDL_RenderFillRects(renderer, hud_rects, count);
+}
+
+void display_toggle_hud(){
+    hud_visible = !hud_visible;
+    display_invalidate();
+}
+
+void display_render_line(u8 line){
+    u8 lcdc = memory[ADDR_LCD_CONTROL];
+    u8 palette = memory[ADDR_BG_PALLETTE];
+    u8* indexes = ppu_frame->indexes[line];
+
+    if(lcdc & LCDC_BG_ENABLE){
+        u16 map_addr = (lcdc & LCDC_BG_MAP) ? ADDR_BGMAP2 : ADDR_BGMAP1;
+        u8 y = line + memory[ADDR_SCROLL_Y];
+        render_tile_span(lcdc, map_addr, memory[ADDR_SCROLL_X], y, WINDOW_WIDTH, indexes);
+    } else {
+        memset(indexes, 0, WINDOW_WIDTH);
+    }
+
+    // WY is compared every line so a mid-frame write still opens the window,
+    // WX is read per line so it can move around between lines
+    if(line == memory[ADDR_WINDOW_Y]){
+        window_y_triggered = true;
+    }
+
+    // on DMG clearing the BG enable bit blanks the window as well
+    int window_x = memory[ADDR_WINDOW_X] - WINDOW_X_OFFSET;
+    bool window_enabled = (lcdc & LCDC_BG_ENABLE) && (lcdc & LCDC_WINDOW_ENABLE);
+    if(window_enabled && window_y_triggered && window_x < WINDOW_WIDTH){
+        u16 map_addr = (lcdc & LCDC_WINDOW_MAP) ? ADDR_BGMAP2 : ADDR_BGMAP1;
+        int start = window_x < 0 ? 0 : window_x;
+        render_tile_span(lcdc, map_addr, start - window_x, window_line, WINDOW_WIDTH - start, &indexes[start]);
+        window_line++;
+    }
+
+    ppu_frame->palettes[line] = palette;
+}
+
+void convert_line(const u8* indexes, const Pixel* lut, Pixel* out){
+    int x = 0;
+
+#ifdef __SSE2__
+    // 16 pixels at a time, widen the indexes to 32 bits and select the
+    // colour with compare masks rather than doing 16 table loads
+    __m128i zero = _mm_setzero_si128();
+    __m128i colours[4];
+    __m128i values[4];
+    for(int i = 0; i < 4; i++){
+        colours[i] = _mm_set1_epi32(lut[i]);
+        values[i] = _mm_set1_epi32(i);
+    }
+
+    for(; x + 16 <= WINDOW_WIDTH; x += 16){
+        __m128i bytes = _mm_loadu_si128((const __m128i*)&indexes[x]);
+        __m128i words[2] = {_mm_unpacklo_epi8(bytes, zero), _mm_unpackhi_epi8(bytes, zero)};
+
+        for(int half = 0; half < 2; half++){
+            __m128i quads[2] = {_mm_unpacklo_epi16(words[half], zero), _mm_unpackhi_epi16(words[half], zero)};
+
+            for(int q = 0; q < 2; q++){
+                __m128i pixels = _mm_and_si128(_mm_cmpeq_epi32(quads[q], values[0]), colours[0]);
+                for(int i = 1; i < 4; i++){
+                    pixels = _mm_or_si128(pixels, _mm_and_si128(_mm_cmpeq_epi32(quads[q], values[i]), colours[i]));
+                }
+                _mm_storeu_si128((__m128i*)&out[x + half * 8 + q * 4], pixels);
             }
+        }
+    }
+#endif
+
+    for(; x < WINDOW_WIDTH; x++){
+        out[x] = lut[indexes[x] & 0x03];
+    }
+}
 
-            // the index of this pixel squashed down into the 8 wide tile
-            bg_idx = tile_index_base + (x / TILE_WIDTH);
+// the only place the indexed frame becomes ARGB, pitch is in pixels and
+// out points at the first line to convert
+void display_convert_lines(const Frame* frame, int first, int count, Pixel* out, int pitch){
+    Pixel lut[4];
 
-            // the tile for this pixel
-            tile_idx = mem_read_u8(bg_idx);
+    for(int y = first; y < first + count; y++){
+        for(int i = 0; i < 4; i++){
+            lut[i] = get_bg_pixel(apply_palette(frame->palettes[y], i));
+        }
 
-            // each tile is 16 bytes long so look at our lines tiles plus some lines in
-            tile_data_addr = tile_data_base + tile_idx * TILE_SIZE;
-            
-            // read the two bytes
-            msb = mem_read_u8(tile_data_addr);
-            lsb = mem_read_u8(tile_data_addr + 1);
+        convert_line(frame->indexes[y], lut, out);
+        out += pitch;
+    }
+}
 
-            // the shift is the position within the 8 pixel tile (-1)
-            shift = TILE_WIDTH - (x % TILE_WIDTH) - 1;
+void display_convert_frame(const Frame* frame, Pixel* out, int pitch){
+    display_convert_lines(frame, 0, WINDOW_HEIGHT, out, pitch);
+}
 
-            // pick the two bits and compile into our 2 bit palette id
-            palette_idx = pick_bit(msb, shift, 1) | pick_bit(lsb, shift, 0);
-            all_pixels[(y * FULL_SCREEN_WIDTH) + x] = get_bg_pixel(palette_idx);
+bool line_changed(const Frame* frame, int y){
+    return frame->palettes[y] != presented_frame.palettes[y] ||
+        memcmp(frame->indexes[y], presented_frame.indexes[y], WINDOW_WIDTH) != 0;
+}
+
+// debug view of the whole background map with the visible frame drawn on,
+// this reads VRAM from the presenter thread so it can tear, fine for debugging
+void render_background_map(Pixel* out, int pitch){
+    u8 lcdc = memory[ADDR_LCD_CONTROL];
+    u8 palette = memory[ADDR_BG_PALLETTE];
+    u16 map_addr = (lcdc & LCDC_BG_MAP) ? ADDR_BGMAP2 : ADDR_BGMAP1;
+    u8 indexes[FULL_SCREEN_WIDTH];
+
+    for(u16 y = 0; y < FULL_SCREEN_HEIGHT; y++){
+        render_tile_span(lcdc, map_addr, 0, y, FULL_SCREEN_WIDTH, indexes);
+
+        for(u16 x = 0; x < FULL_SCREEN_WIDTH; x++){
+            if(is_on_frame_border(x, y)){
+                out[(y * pitch) + x] = 0x00;
+                continue;
+            }
+
+            out[(y * pitch) + x] = get_bg_pixel(apply_palette(palette, indexes[x]));
         }
     }
+}
+
+// emulation thread, hand over the finished frame and start on a free one
+void display_publish_frame(){
+    if(options.frame_hash_path){
+        last_frame_hash = hash_bytes(HASH_OFFSET, ppu_frame, sizeof(Frame));
+    }
 
-    SDL_UpdateTexture(texture, NULL, all_pixels, FULL_SCREEN_WIDTH * sizeof(Pixel));
-    SDL_RenderClear(renderer);
-    display_blit_frame();
-    SDL_RenderPresent(renderer);
+    // nobody is going to pick it up
+    if(options.headless) return;
+
+    int previous = SDL_AtomicSet(&middle_frame, back_frame | FRAME_FRESH);
+
+    // the presenter never picked up the last one
+    if(previous & FRAME_FRESH){
+        frames_dropped++;
+    }
+
+    back_frame = previous & FRAME_INDEX_MASK;
+    ppu_frame = &frames[back_frame];
+}
+
+// presenter thread, swap in the newest complete frame if there is one
+bool display_acquire_frame(){
+    if(!(SDL_AtomicGet(&middle_frame) & FRAME_FRESH)){
+        return false;
+    }
+
+    int previous = SDL_AtomicSet(&middle_frame, front_frame);
+    front_frame = previous & FRAME_INDEX_MASK;
+    return true;
+}
+
+int display_frames_dropped(){
+    return frames_dropped;
+}
+
+int display_frames_duplicated(){
+    return SDL_AtomicGet(&frames_duplicated);
+}
+
+// upload whatever changed since the last present straight into the
+// streaming texture, returns false if there was nothing to show
+bool upload_screen(const Frame* frame){
+    int first = 0;
+    int last = WINDOW_HEIGHT - 1;
+
+    if(presented_frame_valid){
+        while(first < WINDOW_HEIGHT && !line_changed(frame, first)) first++;
+
+        // bit identical to what is on screen already
+        if(first == WINDOW_HEIGHT) return false;
+
+        while(last > first && !line_changed(frame, last)) last--;
+    }
+
+    // locked pixels are write only, so every line inside the rect gets converted
+    SDL_Rect rect = {0, first, WINDOW_WIDTH, last - first + 1};
+    void* pixels;
+    int pitch;
+    if(SDL_LockTexture(texture, &rect, &pixels, &pitch) < 0){
+        LOG("Could not lock texture: %s", SDL_GetError());
+        return false;
+    }
+
+    display_convert_lines(frame, first, rect.h, (Pixel*)pixels, pitch / sizeof(Pixel));
+    SDL_UnlockTexture(texture);
+
+    memcpy(presented_frame.indexes[first], frame->indexes[first], rect.h * WINDOW_WIDTH);
+    memcpy(&presented_frame.palettes[first], &frame->palettes[first], rect.h);
+    presented_frame_valid = true;
+    return true;
+}
+
+bool upload_background_map(){
+    void* pixels;
+    int pitch;
+    if(SDL_LockTexture(texture, NULL, &pixels, &pitch) < 0){
+        LOG("Could not lock texture: %s", SDL_GetError());
+        return false;
+    }
+
+    render_background_map((Pixel*)pixels, pitch / sizeof(Pixel));
+    SDL_UnlockTexture(texture);
+
+    // the map view clobbers the screen area of the texture
+    presented_frame_valid = false;
+    return true;
+}
+
+void render_frame(const Frame* frame){
+    bool changed = false;
+    TIMELINE_BEGIN("render_frame");
+
+    switch(display_mode)
+    {
+        case BACKGROUND_DISPLAY_MODE:
+            changed = upload_background_map();
+            break;
+        case ACTUAL_SIZE_DISPLAY_MODE:
+            changed = upload_screen(frame);
+            break;
+        default:
+            printf("Unknown display mode %d\n", display_mode);
+            break;
+    }
+
+    // a new snapshot is worth a present even when the picture is the same
+    int sequence = stats_sequence();
+    if(hud_visible && sequence != hud_sequence){
+        hud_sequence = sequence;
+        changed = true;
+    }
+
+    if(changed){
+        // the copy covers the whole window so there is no need to clear first
+        display_blit_frame();
+        if(hud_visible) draw_hud();
+
+        TIMELINE_BEGIN("present");
+        SDL_RenderPresent(renderer);
+        TIMELINE_END("present");
+    }
+
+    TIMELINE_END("render_frame");
+}
+
+void display_invalidate(){
+    // whatever is in the texture (or the window) can't be trusted, upload it all next present
+    presented_frame_valid = false;
 }
 
 void display_cycle_window_mode(){
+    display_invalidate();
+
     if(display_mode == BACKGROUND_DISPLAY_MODE) {
         display_mode = ACTUAL_SIZE_DISPLAY_MODE;
     } else {
@@ -203,79 +610,224 @@ void display_cycle_window_mode(){
     }
 }
 
-void display_tick(int clocks) {
+void display_update_stat_interrupt(){
+    // the STAT interrupt fires on the rising edge of the OR of every enabled
+    // source, so two sources overlapping only raise a single interrupt
+    u8 stat = memory[ADDR_LCD_STATUS];
+    u8 mode = stat & STAT_MODE_MASK;
+    bool line = false;
 
-    // only clock up if we are being displayed
-    if ((mem_read_u8(ADDR_LCD_CONTROL) & 0x80) == 0) {
-        if (internal_clock > 0){                                                                            // turn off lcd
-            LOG("Turning LCD Off");
-            // we were showing before so turn off, resetting clocks
-            // and setting black in SDL to mimic no image
-            internal_clock = 0;
-            prev_horizontal_clock = 0;
-            prev_vertical_clock = 0;
-            memset(all_pixels, 0, PIXEL_COUNT * sizeof(Pixel));
-        }
+    if((stat & STAT_HBLANK_INTERRUPT) && mode == PPU_MODE_HBLANK) line = true;
+    if((stat & STAT_VBLANK_INTERRUPT) && mode == PPU_MODE_VBLANK) line = true;
+    if((stat & STAT_OAM_INTERRUPT) && mode == PPU_MODE_OAM_SCAN) line = true;
+    if((stat & STAT_LYC_INTERRUPT) && (stat & STAT_COINCIDENCE)) line = true;
 
-        return;
-    } else {
-        // if we are turned on, and our previous clocks are 0
-        // then we know that we JUST got turned on and have rendered no previous frames
-        if (internal_clock == 0 && prev_vertical_clock == 0 && prev_horizontal_clock == 0){                 // turn on lcd
-            LOG("Turning LCD On");
-            memset(all_pixels, 0xffffffff, PIXEL_COUNT * sizeof(Pixel));
-        }
+    if(line && !stat_interrupt_line){
+        mem_set_flag(ADDR_INTERRUPT_FLAGS, INTERRUPT_LCDC_BIT);
     }
-    
-    int overflow = (internal_clock + clocks) - FRAME_RENDER_CLOCKS;
-    if(overflow > 0){
-        internal_clock = overflow; 
+
+    stat_interrupt_line = line;
+}
+
+void display_compare_lyc(){
+    if(memory[ADDR_LCDY_COORD] == memory[ADDR_LCDY_COMPARE]){
+        memory[ADDR_LCD_STATUS] |= STAT_COINCIDENCE;
     } else {
-        internal_clock += clocks;
+        memory[ADDR_LCD_STATUS] &= ~STAT_COINCIDENCE;
     }
+}
 
-    u8 horizontal_clock = internal_clock % CLOCKS_PER_LINE; // it takes 114 clocks per line
-    u8 vertical_clock = (internal_clock / CLOCKS_PER_LINE) + 1; // how many horizontal lines we've done +1
+void display_set_mode(u8 mode){
+    ppu_mode = mode;
+    memory[ADDR_LCD_STATUS] = (memory[ADDR_LCD_STATUS] & ~STAT_MODE_MASK) | mode;
+}
 
-    mem_write_u8(ADDR_LCDY_COORD, vertical_clock);
-   
-    // TODO 
-    // psmith Match 10 2017
-    // set the lcd status register 0xFF41
-    // trigger interrupts if selected
-    // draw stuff, can probably draw the whole frame in the first 0-64 clocks...
-    // could fake line by line rendering?
+void display_set_line(u8 line){
+    memory[ADDR_LCDY_COORD] = line;
+    display_compare_lyc();
+}
+
+// runs at the end of whatever mode we are in, moves to the next one and
+// schedules itself for the end of that
+void display_event(u64 cycle){
+    u8 line = memory[ADDR_LCDY_COORD];
 
-    // fake rendering at the beginning of a frame we just render all
-    // TODO fake horizontal lines...
-    if (prev_vertical_clock > 144 && vertical_clock < 144){
-        render_frame();
+    switch(ppu_mode)
+    {
+        case PPU_MODE_OAM_SCAN:
+            display_set_mode(PPU_MODE_PIXEL_TRANSFER);
+            scheduler_schedule(EVENT_PPU, cycle + PIXEL_TRANSFER_CLOCKS);
+            break;
+        case PPU_MODE_PIXEL_TRANSFER:
+            TIMELINE_BEGIN("ppu line");
+            display_render_line(line);
+            TIMELINE_END("ppu line");
+            display_set_mode(PPU_MODE_HBLANK);
+            scheduler_schedule(EVENT_PPU, cycle + HBLANK_CLOCKS);
+            break;
+        case PPU_MODE_HBLANK:
+            display_set_line(line + 1);
+            if(line + 1 == VISIBLE_LINES){
+                display_set_mode(PPU_MODE_VBLANK);
+                mem_set_flag(ADDR_INTERRUPT_FLAGS, INTERRUPT_VBLANK_BIT);
+                display_publish_frame();
+                scheduler_schedule(EVENT_PPU, cycle + CLOCKS_PER_LINE);
+            } else {
+                display_set_mode(PPU_MODE_OAM_SCAN);
+                scheduler_schedule(EVENT_PPU, cycle + OAM_SCAN_CLOCKS);
+            }
+            break;
+        case PPU_MODE_VBLANK:
+            if(line + 1 == TOTAL_LINES){
+                window_line = 0;
+                window_y_triggered = false;
+                display_set_line(0);
+                display_set_mode(PPU_MODE_OAM_SCAN);
+                scheduler_schedule(EVENT_PPU, cycle + OAM_SCAN_CLOCKS);
+            } else {
+                display_set_line(line + 1);
+                scheduler_schedule(EVENT_PPU, cycle + CLOCKS_PER_LINE);
+            }
+            break;
+        default:
+            printf("Unknown ppu mode %d\n", ppu_mode);
+            break;
     }
 
-    if (vertical_clock >= 145) {                   // vblank
-        if(prev_vertical_clock <= 144) {
-            // we just entered vblank
-            mem_set_flag(ADDR_INTERRUPT_FLAGS, INTERRUPT_VBLANK_BIT);
-        }
-    } else if (horizontal_clock < 21) {            // oam load
-        if(prev_horizontal_clock >= 155) {
-            // TODO interrupt
+    display_update_stat_interrupt();
+}
+
+void display_lcd_on(){
+    LOG("Turning LCD On");
+    // blank white until the first lines come in, a zero palette maps every index to white
+    memset(ppu_frame->indexes, 0, sizeof(ppu_frame->indexes));
+    memset(ppu_frame->palettes, 0x00, sizeof(ppu_frame->palettes));
+    window_line = 0;
+    window_y_triggered = false;
+
+    // the first line starts straight away with an OAM scan
+    display_set_line(0);
+    display_set_mode(PPU_MODE_OAM_SCAN);
+    display_update_stat_interrupt();
+    scheduler_schedule(EVENT_PPU, scheduler_cycles + OAM_SCAN_CLOCKS);
+}
+
+void display_lcd_off(){
+    // we were showing before so turn off, stop the state machine
+    // and set black in SDL to mimic no image
+    LOG("Turning LCD Off");
+    scheduler_cancel(EVENT_PPU);
+    display_set_line(0);
+    display_set_mode(PPU_MODE_HBLANK);
+    stat_interrupt_line = false;
+    memset(ppu_frame->indexes, 0, sizeof(ppu_frame->indexes));
+    memset(ppu_frame->palettes, 0xff, sizeof(ppu_frame->palettes));
+
+    // no more vblanks are coming, show the blank screen now
+    display_publish_frame();
+}
+
+void display_write_register(u16 addr, u8 value){
+    switch(addr)
+    {
+        case ADDR_LCD_CONTROL:
+            {
+                u8 previous = memory[ADDR_LCD_CONTROL];
+                memory[ADDR_LCD_CONTROL] = value;
+
+                if((previous & LCDC_DISPLAY_ENABLE) && !(value & LCDC_DISPLAY_ENABLE)){
+                    display_lcd_off();
+                } else if(!(previous & LCDC_DISPLAY_ENABLE) && (value & LCDC_DISPLAY_ENABLE)){
+                    display_lcd_on();
+                }
+            }
+            break;
+        case ADDR_LCD_STATUS:
+            // only the interrupt selects are writable, mode and coincidence are ours
+            memory[ADDR_LCD_STATUS] = (value & STAT_WRITABLE_MASK) | (memory[ADDR_LCD_STATUS] & ~STAT_WRITABLE_MASK);
+            display_update_stat_interrupt();
+            break;
+        case ADDR_LCDY_COORD:
+            // read only
+            break;
+        case ADDR_LCDY_COMPARE:
+            memory[ADDR_LCDY_COMPARE] = value;
+            if(memory[ADDR_LCD_CONTROL] & LCDC_DISPLAY_ENABLE){
+                display_compare_lyc();
+                display_update_stat_interrupt();
+            }
+            break;
+        default:
+            memory[addr] = value;
+            break;
+    }
+}
+
+// runs on the main thread (SDL wants its window and renderer there on
+// some platforms), the emulation thread never waits on anything in here
+void display_present_loop(){
+    SDL_DisplayMode mode;
+    int refresh_rate = 60;
+    if(SDL_GetWindowDisplayMode(window, &mode) == 0 && mode.refresh_rate > 0){
+        refresh_rate = mode.refresh_rate;
+    }
+
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 period = frequency / refresh_rate;
+    Uint64 deadline = SDL_GetPerformanceCounter() + period;
+    Uint64 next_title = deadline + frequency;
+
+    while(running){
+        system_tick();
+
+        // achieved emulation speed, once a second
+        if(deadline >= next_title){
+            char title[64];
+            snprintf(title, sizeof(title), "cgbemu - %.0f%%", pacing_achieved_speed() * 100);
+            SDL_SetWindowTitle(window, title);
+            next_title = deadline + frequency;
         }
-    } else if(horizontal_clock < 64) {             // pixel transfer
-        if(prev_horizontal_clock < 21) {
-            // TODO interrupt
+
+        if(display_acquire_frame()){
+            render_frame(&frames[front_frame]);
+        } else {
+            // a refresh went by with nothing new to show
+            SDL_AtomicAdd(&frames_duplicated, 1);
+
+            // the background map view shows live VRAM, keep it moving
+            if(display_mode == BACKGROUND_DISPLAY_MODE){
+                render_frame(&frames[front_frame]);
+            }
         }
-    } else {                                      // hblank
-        if(prev_horizontal_clock <= 64) {
-            // TODO interrupt
+
+        Uint64 now = SDL_GetPerformanceCounter();
+        if(now < deadline){
+            SDL_Delay((Uint32)((deadline - now) * 1000 / frequency));
+            deadline += period;
+        } else {
+            // fell behind (or vsync blocked us), don't try to catch up
+            deadline = now + period;
         }
     }
+}
 
-    prev_horizontal_clock = horizontal_clock;
-    prev_vertical_clock = vertical_clock;
+// the frame in progress comes along too, the rest of it is drawn after loading
+void display_serialize(Savestate* state){
+    SAVESTATE_FIELD(state, ppu_mode);
+    SAVESTATE_FIELD(state, stat_interrupt_line);
+    SAVESTATE_FIELD(state, window_line);
+    SAVESTATE_FIELD(state, window_y_triggered);
+    SAVESTATE_FIELD(state, *ppu_frame);
+    SAVESTATE_FIELD(state, last_frame_hash);
+}
+
+u64 display_last_frame_hash(){
+    return last_frame_hash;
 }
 
 void display_shutdown() {
+    if(options.headless) return;
+
     // Close and destroy the window
     SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer); 
@@ -283,6 +835,14 @@ void display_shutdown() {
 }
 
 int display_init(){
+    init_tile_row_spread();
+    scheduler_register(EVENT_PPU, display_event);
+
+    // the PPU still runs headless, there is just nothing to show it on
+    if(options.headless){
+        return 1;
+    }
+
     // Create an application window with the following settings:
     // TODO windowing instead of showing whole texture
     window = SDL_CreateWindow(
@@ -318,7 +878,7 @@ int display_init(){
         return 0;
     }
     
-    SDL_UpdateTexture(texture, NULL, all_pixels, FULL_SCREEN_WIDTH * sizeof(unsigned int));
+    display_invalidate();
 
     printf("Window created...\n");
     return 1;
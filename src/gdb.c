@@ -0,0 +1,613 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "breakpoint.h"
+#include "common.h"
+#include "cpu.h"
+#include "gdb.h"
+#include "memory.h"
+
+bool gdb_attached = false;
+
+#ifndef _WIN32
+
+#define GDB_UNIX_PREFIX "unix:"
+
+// what we tell gdb in qSupported (hex), the biggest packet either side sends
+#define GDB_PACKET_SIZE (0x1000)
+
+// how often a stopped stub looks up to see if the emulator is quitting
+#define GDB_POLL_MS (100)
+
+#define GDB_REGISTER_COUNT (6)
+
+#define GDB_BANK_START (0x4000)
+#define GDB_BANK_SIZE (0x4000)
+
+// the IO registers, which live with their owners rather than in memory[]
+#define GDB_IO_START (0xff00)
+#define GDB_IO_END (0xff80)
+
+// unix signal numbers, which is what stop replies carry
+#define GDB_SIGINT (2)
+#define GDB_SIGTRAP (5)
+
+#define GDB_INTERRUPT (0x03)
+
+// a client that hangs up mid-reply must not SIGPIPE the emulator, linux
+// says so per send, macOS per socket (see gdb_accept)
+#ifdef MSG_NOSIGNAL
+#define GDB_SEND_FLAGS (MSG_NOSIGNAL)
+#else
+#define GDB_SEND_FLAGS (0)
+#endif
+
+// stop reason for ctrl-c, next to the BREAKPOINT_* kinds
+#define GDB_INTERRUPTED (0)
+
+int gdb_listener = -1;
+int gdb_client = -1;
+const char* gdb_unix_path = NULL;
+bool gdb_no_ack = false;
+
+char gdb_packet[GDB_PACKET_SIZE + 1];
+char gdb_reply[GDB_PACKET_SIZE + 1];
+char gdb_stop_reply[64] = "S05";
+
+u16* const gdb_registers[GDB_REGISTER_COUNT] = {
+    &cpu_registers.AF, &cpu_registers.BC, &cpu_registers.DE,
+    &cpu_registers.HL, &cpu_registers.SP, &cpu_registers.PC
+};
+
+const char gdb_hex[] = "0123456789abcdef";
+
+void gdb_detach(){
+    if(gdb_client >= 0) close(gdb_client);
+    gdb_client = -1;
+    gdb_attached = false;
+    gdb_no_ack = false;
+    breakpoint_clear_remote();
+    printf("gdb detached\n");
+}
+
+bool gdb_send_all(const char* data, int length){
+    while(length > 0){
+        ssize_t sent = send(gdb_client, data, length, GDB_SEND_FLAGS);
+        if(sent < 0 && errno == EINTR) continue;
+        if(sent <= 0) return false;
+        data += sent;
+        length -= (int)sent;
+    }
+    return true;
+}
+
+// $data#checksum. Acks coming back are skipped by the reader, over TCP a
+// retransmit is never needed
+void gdb_send(const char* data){
+    if(gdb_client < 0) return;
+
+    char frame[GDB_PACKET_SIZE + 8];
+    u8 checksum = 0;
+    int length = 0;
+
+    frame[length++] = '$';
+    for(const char* c = data; *c && length < GDB_PACKET_SIZE + 4; c++){
+        frame[length++] = *c;
+        checksum += (u8)*c;
+    }
+    frame[length++] = '#';
+    frame[length++] = gdb_hex[checksum >> 4];
+    frame[length++] = gdb_hex[checksum & 0x0f];
+
+    if(!gdb_send_all(frame, length)) gdb_detach();
+}
+
+// one byte from the client, -1 once it has gone or the emulator is quitting
+int gdb_read_byte(){
+    while(running && gdb_client >= 0){
+        struct pollfd fd = {gdb_client, POLLIN, 0};
+        int ready = poll(&fd, 1, GDB_POLL_MS);
+        if(ready < 0 && errno != EINTR) return -1;
+        if(ready <= 0) continue;
+
+        u8 byte;
+        ssize_t count = recv(gdb_client, &byte, 1, 0);
+        if(count == 1) return byte;
+        if(count < 0 && errno == EINTR) continue;
+        return -1;
+    }
+    return -1;
+}
+
+int gdb_hex_value(int c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// the next packet's payload into gdb_packet, false when the client has gone
+bool gdb_receive(){
+    for(;;){
+        int c = gdb_read_byte();
+        if(c < 0) return false;
+
+        // acks, nacks and interrupts that came in while we were stopped anyway
+        if(c != '$') continue;
+
+        int length = 0;
+        u8 checksum = 0;
+        while((c = gdb_read_byte()) >= 0 && c != '#'){
+            if(length < GDB_PACKET_SIZE) gdb_packet[length++] = (char)c;
+            checksum += (u8)c;
+        }
+        if(c < 0) return false;
+        gdb_packet[length] = 0;
+
+        int high = gdb_read_byte();
+        int low = gdb_read_byte();
+        if(high < 0 || low < 0) return false;
+
+        bool valid = gdb_hex_value(high) * 16 + gdb_hex_value(low) == checksum;
+        if(!gdb_no_ack && !gdb_send_all(valid ? "+" : "-", 1)) return false;
+        if(valid) return true;
+    }
+}
+
+u32 gdb_parse_hex(const char** text){
+    u32 value = 0;
+    int digit;
+    while((digit = gdb_hex_value(**text)) >= 0){
+        value = value << 4 | digit;
+        (*text)++;
+    }
+    return value;
+}
+
+void gdb_write_u16(char* out, u16 value){
+    // little endian, like the target
+    out[0] = gdb_hex[(value >> 4) & 0x0f];
+    out[1] = gdb_hex[value & 0x0f];
+    out[2] = gdb_hex[(value >> 12) & 0x0f];
+    out[3] = gdb_hex[(value >> 8) & 0x0f];
+    out[4] = 0;
+}
+
+bool gdb_read_u16(const char* text, u16* value){
+    for(int i = 0; i < 4; i++){
+        if(gdb_hex_value(text[i]) < 0) return false;
+    }
+    *value = (u16)(gdb_hex_value(text[0]) << 4 | gdb_hex_value(text[1]) |
+                   gdb_hex_value(text[2]) << 12 | gdb_hex_value(text[3]) << 8);
+    return true;
+}
+
+// a banked address outside the mapped bank goes to the cartridge itself
+u8* gdb_memory(u32 addr){
+    u16 offset = (u16)addr;
+    int bank = addr >> 16;
+
+    if(bank && bank != mem_rom_bank && offset >= GDB_BANK_START && offset < GDB_BANK_START + GDB_BANK_SIZE){
+        long position = (long)bank * GDB_BANK_SIZE + (offset - GDB_BANK_START);
+        if(!cartridge || position >= cartridge->size) return NULL;
+        return &cartridge->data[position];
+    }
+    return &memory[offset];
+}
+
+bool gdb_io(u32 addr){
+    u16 offset = (u16)addr;
+    return offset >= GDB_IO_START && offset < GDB_IO_END;
+}
+
+// m addr,length. IO registers are read through their owners, which has no
+// side effect the game could see
+void gdb_read_memory(const char* args){
+    u32 addr = gdb_parse_hex(&args);
+    if(*args++ != ','){
+        gdb_send("E01");
+        return;
+    }
+
+    u32 length = gdb_parse_hex(&args);
+    if(length > GDB_PACKET_SIZE / 2) length = GDB_PACKET_SIZE / 2;
+
+    for(u32 i = 0; i < length; i++){
+        u8 value;
+        if(gdb_io(addr + i)){
+            value = mem_read_io((u16)(addr + i));
+        } else {
+            u8* byte = gdb_memory(addr + i);
+            if(!byte){
+                // a partial read is fine, nothing at all is an error
+                if(i == 0){
+                    gdb_send("E14");
+                    return;
+                }
+                length = i;
+                break;
+            }
+            value = *byte;
+        }
+        gdb_reply[i * 2] = gdb_hex[value >> 4];
+        gdb_reply[i * 2 + 1] = gdb_hex[value & 0x0f];
+    }
+    gdb_reply[length * 2] = 0;
+    gdb_send(gdb_reply);
+}
+
+// M addr,length:bytes, IO register writes have their usual effects
+void gdb_write_memory(const char* args){
+    u32 addr = gdb_parse_hex(&args);
+    if(*args++ != ','){
+        gdb_send("E01");
+        return;
+    }
+
+    u32 length = gdb_parse_hex(&args);
+    if(*args++ != ':'){
+        gdb_send("E01");
+        return;
+    }
+
+    for(u32 i = 0; i < length; i++){
+        int high = gdb_hex_value(args[i * 2]);
+        int low = high < 0 ? -1 : gdb_hex_value(args[i * 2 + 1]);
+        if(low < 0){
+            gdb_send("E01");
+            return;
+        }
+
+        u8 value = (u8)(high << 4 | low);
+        if(gdb_io(addr + i)){
+            mem_write_io((u16)(addr + i), value);
+            continue;
+        }
+
+        u8* byte = gdb_memory(addr + i);
+        if(!byte){
+            gdb_send("E01");
+            return;
+        }
+        *byte = value;
+    }
+    gdb_send("OK");
+}
+
+void gdb_read_registers(){
+    for(int i = 0; i < GDB_REGISTER_COUNT; i++){
+        gdb_write_u16(&gdb_reply[i * 4], *gdb_registers[i]);
+    }
+    gdb_send(gdb_reply);
+}
+
+void gdb_write_registers(const char* args){
+    // all or nothing
+    u16 values[GDB_REGISTER_COUNT];
+    for(int i = 0; i < GDB_REGISTER_COUNT; i++){
+        if(!gdb_read_u16(&args[i * 4], &values[i])){
+            gdb_send("E01");
+            return;
+        }
+    }
+    for(int i = 0; i < GDB_REGISTER_COUNT; i++){
+        *gdb_registers[i] = values[i];
+    }
+    gdb_send("OK");
+}
+
+// p n and P n=value
+void gdb_register(const char* args, bool write){
+    u32 index = gdb_parse_hex(&args);
+    if(index >= GDB_REGISTER_COUNT){
+        gdb_send("E01");
+        return;
+    }
+
+    if(!write){
+        gdb_write_u16(gdb_reply, *gdb_registers[index]);
+        gdb_send(gdb_reply);
+        return;
+    }
+
+    u16 value;
+    if(*args++ != '=' || !gdb_read_u16(args, &value)){
+        gdb_send("E01");
+        return;
+    }
+    *gdb_registers[index] = value;
+    gdb_send("OK");
+}
+
+// Z type,addr,kind and z type,addr,kind. Watchpoints cover kind bytes
+void gdb_breakpoint(const char* args, bool insert){
+    static const int kinds[] = {
+        BREAKPOINT_EXECUTE, BREAKPOINT_EXECUTE, BREAKPOINT_WRITE,
+        BREAKPOINT_READ, BREAKPOINT_READ | BREAKPOINT_WRITE
+    };
+
+    u32 type = gdb_parse_hex(&args);
+    if(type >= sizeof(kinds) / sizeof(kinds[0]) || *args++ != ','){
+        gdb_send("");
+        return;
+    }
+
+    u32 addr = gdb_parse_hex(&args);
+    u32 length = 1;
+    if(*args++ == ',' && type >= 2) length = gdb_parse_hex(&args);
+    if(length < 1 || length > 0x10){
+        gdb_send("E01");
+        return;
+    }
+
+    int bank = (addr >> 16) ? (int)(addr >> 16 & 0xff) : BREAKPOINT_ANY_BANK;
+    for(u32 i = 0; i < length; i++){
+        u16 target = (u16)(addr + i);
+        if(insert && breakpoint_add_remote(kinds[type], bank, target) < 0){
+            gdb_send("E0e");
+            return;
+        }
+        if(!insert) breakpoint_remove_remote(kinds[type], bank, target);
+    }
+    gdb_send("OK");
+}
+
+// c [addr] and s [addr] can move PC first
+void gdb_resume_at(const char* args){
+    if(gdb_hex_value(*args) >= 0){
+        cpu_registers.PC = (u16)gdb_parse_hex(&args);
+    }
+}
+
+bool gdb_query(const char* packet){
+    if(strncmp(packet, "qSupported", 10) == 0){
+        snprintf(gdb_reply, sizeof(gdb_reply), "PacketSize=%x;QStartNoAckMode+", GDB_PACKET_SIZE);
+        gdb_send(gdb_reply);
+    } else if(strcmp(packet, "QStartNoAckMode") == 0){
+        gdb_send("OK");
+        gdb_no_ack = true;
+    } else if(strcmp(packet, "qAttached") == 0){
+        gdb_send("1");
+    } else if(strcmp(packet, "qC") == 0){
+        gdb_send("QC1");
+    } else if(strcmp(packet, "qfThreadInfo") == 0){
+        gdb_send("m1");
+    } else if(strcmp(packet, "qsThreadInfo") == 0){
+        gdb_send("l");
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void gdb_set_stop_reply(int reason, u16 addr){
+    switch(reason){
+        case BREAKPOINT_WRITE:
+            snprintf(gdb_stop_reply, sizeof(gdb_stop_reply), "T%02xwatch:%04x;", GDB_SIGTRAP, addr);
+            break;
+        case BREAKPOINT_READ:
+            snprintf(gdb_stop_reply, sizeof(gdb_stop_reply), "T%02xrwatch:%04x;", GDB_SIGTRAP, addr);
+            break;
+        case BREAKPOINT_READ | BREAKPOINT_WRITE:
+            snprintf(gdb_stop_reply, sizeof(gdb_stop_reply), "T%02xawatch:%04x;", GDB_SIGTRAP, addr);
+            break;
+        case GDB_INTERRUPTED:
+            snprintf(gdb_stop_reply, sizeof(gdb_stop_reply), "S%02x", GDB_SIGINT);
+            break;
+        default:
+            snprintf(gdb_stop_reply, sizeof(gdb_stop_reply), "S%02x", GDB_SIGTRAP);
+            break;
+    }
+
+}
+
+void gdb_serve(){
+    while(gdb_attached && gdb_receive()){
+        const char* args = &gdb_packet[1];
+
+        switch(gdb_packet[0]){
+            case '?':
+                gdb_send(gdb_stop_reply);
+                break;
+            case 'g':
+                gdb_read_registers();
+                break;
+            case 'G':
+                gdb_write_registers(args);
+                break;
+            case 'p':
+                gdb_register(args, false);
+                break;
+            case 'P':
+                gdb_register(args, true);
+                break;
+            case 'm':
+                gdb_read_memory(args);
+                break;
+            case 'M':
+                gdb_write_memory(args);
+                break;
+            case 'Z':
+                gdb_breakpoint(args, true);
+                break;
+            case 'z':
+                gdb_breakpoint(args, false);
+                break;
+            case 'c':
+                gdb_resume_at(args);
+                return;
+            case 's':
+                gdb_resume_at(args);
+                breakpoint_step();
+                return;
+            case 'H':
+            case 'T':
+                // there's the one thread
+                gdb_send("OK");
+                break;
+            case 'D':
+                gdb_send("OK");
+                gdb_detach();
+                return;
+            case 'k':
+                printf("Killed by gdb\n");
+                running = 0;
+                gdb_detach();
+                return;
+            default:
+                // an empty reply means not supported
+                if(!gdb_query(gdb_packet)) gdb_send("");
+                break;
+        }
+    }
+
+    // gone without a word, keep running without it
+    if(gdb_attached) gdb_detach();
+}
+
+void gdb_stop(int reason, u16 addr){
+    if(!gdb_attached) return;
+
+    gdb_set_stop_reply(reason, addr);
+    gdb_send(gdb_stop_reply);
+    gdb_serve();
+}
+
+void gdb_accept(){
+    int client = accept(gdb_listener, NULL, NULL);
+    if(client < 0) return;
+
+    int yes = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+#ifdef SO_NOSIGPIPE
+    setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+#endif
+
+    gdb_client = client;
+    gdb_attached = true;
+    printf("gdb attached at PC %04x\n", cpu_registers.PC);
+
+    // stopped where we are, gdb asks why itself with '?'
+    gdb_set_stop_reply(BREAKPOINT_STEP, 0);
+    gdb_serve();
+}
+
+void gdb_poll(){
+    if(gdb_listener < 0) return;
+
+    if(gdb_client < 0){
+        gdb_accept();
+        return;
+    }
+
+    // ctrl-c while running is a lone 0x03 outside any packet
+    u8 byte;
+    ssize_t count = recv(gdb_client, &byte, 1, MSG_DONTWAIT);
+    if(count == 0 || (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)){
+        gdb_detach();
+    } else if(count == 1 && byte == GDB_INTERRUPT){
+        gdb_stop(GDB_INTERRUPTED, 0);
+    }
+}
+
+bool gdb_init(const char* address){
+    if(!address) return true;
+
+    bool unix_socket = strncmp(address, GDB_UNIX_PREFIX, strlen(GDB_UNIX_PREFIX)) == 0;
+    int listener = socket(unix_socket ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+    if(listener < 0){
+        printf("Unable to create the gdb socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    int bound;
+    if(unix_socket){
+        struct sockaddr_un local = {0};
+        local.sun_family = AF_UNIX;
+        gdb_unix_path = address + strlen(GDB_UNIX_PREFIX);
+        if(strlen(gdb_unix_path) >= sizeof(local.sun_path)){
+            printf("gdb socket path %s is too long\n", gdb_unix_path);
+            close(listener);
+            return false;
+        }
+        strcpy(local.sun_path, gdb_unix_path);
+
+        // a stale socket from a run that didn't clean up
+        unlink(gdb_unix_path);
+        bound = bind(listener, (struct sockaddr*)&local, sizeof(local));
+    } else {
+        int port = atoi(address);
+        if(port <= 0 || port > 0xffff){
+            printf("gdb wants a port or unix:<path>, not %s\n", address);
+            close(listener);
+            return false;
+        }
+
+        int yes = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+        // never reachable from outside this machine
+        struct sockaddr_in local = {0};
+        local.sin_family = AF_INET;
+        local.sin_port = htons((u16)port);
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bound = bind(listener, (struct sockaddr*)&local, sizeof(local));
+    }
+
+    if(bound < 0 || listen(listener, 1) < 0){
+        printf("Unable to listen for gdb on %s: %s\n", address, strerror(errno));
+        close(listener);
+        gdb_unix_path = NULL;
+        return false;
+    }
+
+    fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+    gdb_listener = listener;
+    printf("Listening for gdb on %s\n", address);
+    return true;
+}
+
+void gdb_shutdown(){
+    if(gdb_client >= 0) gdb_detach();
+    if(gdb_listener >= 0) close(gdb_listener);
+    gdb_listener = -1;
+
+    if(gdb_unix_path){
+        unlink(gdb_unix_path);
+        gdb_unix_path = NULL;
+    }
+}
+
+#else
+
+bool gdb_init(const char* address){
+    if(!address) return true;
+
+    printf("The gdb stub needs POSIX sockets, it isn't in the Windows build\n");
+    return false;
+}
+
+void gdb_shutdown(){
+}
+
+void gdb_poll(){
+}
+
+void gdb_stop(int reason, u16 addr){
+}
+
+#endif
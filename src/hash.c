@@ -0,0 +1,12 @@
+#include "common.h"
+#include "hash.h"
+
+#define HASH_PRIME (0x100000001b3ULL)
+
+u64 hash_bytes(u64 hash, const void* data, int size){
+    const u8* bytes = (const u8*)data;
+    for(int i = 0; i < size; i++){
+        hash = (hash ^ bytes[i]) * HASH_PRIME;
+    }
+    return hash;
+}
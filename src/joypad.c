@@ -0,0 +1,69 @@
+#include <stdbool.h>
+
+#include "SDL.h"
+#include "common.h"
+#include "joypad.h"
+#include "memory.h"
+
+// P1 bits 4 and 5 select the direction and button rows (active low),
+// the low nibble reads back the selected rows, also active low
+#define P1_SELECT_DIRECTIONS (0x10)
+#define P1_SELECT_BUTTONS (0x20)
+#define P1_SELECT_MASK (0x30)
+
+SDL_atomic_t host_buttons;
+
+u8 latched_buttons = 0;
+u8 joypad_select = P1_SELECT_MASK;
+
+// input lines as last seen, pressed is set (inverted from P1)
+u8 joypad_lines = 0;
+
+void joypad_set_host_buttons(u8 buttons){
+    SDL_AtomicSet(&host_buttons, buttons);
+}
+
+u8 selected_lines(){
+    u8 lines = 0;
+    if(!(joypad_select & P1_SELECT_DIRECTIONS)) lines |= latched_buttons & 0x0f;
+    if(!(joypad_select & P1_SELECT_BUTTONS)) lines |= latched_buttons >> 4;
+    return lines;
+}
+
+// the interrupt fires when any selected line goes low, which is either a
+// press or a row with something held being selected
+void update_lines(){
+    u8 lines = selected_lines();
+    if(lines & ~joypad_lines){
+        mem_set_flag(ADDR_INTERRUPT_FLAGS, INTERRUPT_JOYPAD_BIT);
+    }
+    joypad_lines = lines;
+}
+
+u8 joypad_host_buttons(){
+    return (u8)SDL_AtomicGet(&host_buttons);
+}
+
+void joypad_latch(u8 buttons){
+    latched_buttons = buttons;
+    update_lines();
+}
+
+u8 joypad_buttons(){
+    return latched_buttons;
+}
+
+u8 joypad_read_register(){
+    return 0xc0 | joypad_select | (~selected_lines() & 0x0f);
+}
+
+void joypad_write_register(u8 value){
+    joypad_select = value & P1_SELECT_MASK;
+    update_lines();
+}
+
+void joypad_serialize(Savestate* state){
+    SAVESTATE_FIELD(state, latched_buttons);
+    SAVESTATE_FIELD(state, joypad_select);
+    SAVESTATE_FIELD(state, joypad_lines);
+}
@@ -0,0 +1,443 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "SDL.h"
+#include "common.h"
+#include "log_async.h"
+#include "logging.h"
+#include "scheduler.h"
+
+// rings are per thread and single producer, single consumer
+#define LOG_MAX_THREADS (8)
+#define LOG_RING_SIZE (64 * 1024)
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+
+// distinct call sites, the table is hashed so keep it a power of two
+#define LOG_MAX_FORMATS (1024)
+#define LOG_MAX_ARGS (8)
+#define LOG_MAX_SPEC (16)
+
+// %s arguments are copied into the record, longer ones get cut
+#define LOG_MAX_STRING (128)
+
+// fills the end of the ring when a record doesn't fit before the wrap
+#define LOG_PADDING (0xffff)
+
+// an idle writer sleeps until a record wakes it, this is only a backstop
+#define LOG_IDLE_MS (100)
+
+typedef enum {
+    ARG_INT,
+    ARG_LONG,
+    ARG_LONG_LONG,
+    ARG_SIZE,
+    ARG_DOUBLE,
+    ARG_POINTER,
+    ARG_STRING
+} LogArgType;
+
+// a call site's format split up once, so the hot path only copies values
+typedef struct {
+    const char* format;
+    const char* file_name;
+    int line_number;
+
+    int arg_count;
+    u8 types[LOG_MAX_ARGS];
+    char specs[LOG_MAX_ARGS][LOG_MAX_SPEC];
+    int spec_starts[LOG_MAX_ARGS];
+    int spec_ends[LOG_MAX_ARGS];
+} LogFormat;
+
+// records are padded to 8 bytes and never wrap, the args follow the header
+typedef struct {
+    u16 size;
+    u16 format;
+    u32 unused;
+    u64 cycle;
+} LogRecord;
+
+typedef struct {
+    u8 data[LOG_RING_SIZE];
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+} LogRing;
+
+LogFormat log_formats[LOG_MAX_FORMATS];
+SDL_atomic_t log_format_ready[LOG_MAX_FORMATS];
+SDL_SpinLock log_format_lock = 0;
+
+LogRing* log_rings[LOG_MAX_THREADS];
+SDL_atomic_t log_ring_count;
+THREAD_LOCAL LogRing* thread_ring = NULL;
+THREAD_LOCAL bool thread_ring_refused = false;
+
+SDL_atomic_t log_dropped;
+SDL_atomic_t log_running;
+SDL_atomic_t log_stopping;
+SDL_Thread* log_thread = NULL;
+FILE* log_file = NULL;
+
+// set by the writer before it sleeps, whoever clears it posts the wakeup
+// so a busy logger costs one atomic per record and no system calls
+SDL_atomic_t log_writer_waiting;
+SDL_sem* log_wakeup = NULL;
+
+// pull the conversions out of a printf format, false if it has anything
+// we can't capture by value (* widths, %n, long double, too many args)
+bool parse_format(const char* format, LogFormat* out){
+    out->arg_count = 0;
+
+    for(const char* c = format; *c; c++){
+        if(*c != '%') continue;
+
+        const char* start = c++;
+        if(*c == '%') continue;
+
+        while(*c && strchr("-+ #0", *c)) c++;
+        while(*c >= '0' && *c <= '9') c++;
+        if(*c == '.'){
+            c++;
+            while(*c >= '0' && *c <= '9') c++;
+        }
+
+        int longs = 0;
+        bool size = false;
+        while(*c && strchr("hlzjt", *c)){
+            if(*c == 'l') longs++;
+            if(*c == 'z' || *c == 'j' || *c == 't') size = true;
+            c++;
+        }
+
+        LogArgType type;
+        if(*c && strchr("diouxXc", *c)){
+            type = size ? ARG_SIZE : longs == 2 ? ARG_LONG_LONG : longs == 1 ? ARG_LONG : ARG_INT;
+        } else if(*c && strchr("feEgGaA", *c)){
+            type = ARG_DOUBLE;
+        } else if(*c == 's'){
+            type = ARG_STRING;
+        } else if(*c == 'p'){
+            type = ARG_POINTER;
+        } else {
+            return false;
+        }
+
+        int length = (int)(c - start) + 1;
+        if(out->arg_count == LOG_MAX_ARGS || length >= LOG_MAX_SPEC) return false;
+
+        int arg = out->arg_count++;
+        out->types[arg] = type;
+        memcpy(out->specs[arg], start, length);
+        out->specs[arg][length] = '\0';
+        out->spec_starts[arg] = (int)(start - format);
+        out->spec_ends[arg] = (int)(c - format) + 1;
+    }
+
+    return true;
+}
+
+// call sites are identified by their format string and line, looked up
+// without locking once they are in the table
+int format_id(const char* file_name, int line_number, const char* format){
+    u32 hash = (u32)(((size_t)format >> 3) * 2654435761u) ^ (u32)line_number;
+
+    for(int probe = 0; probe < LOG_MAX_FORMATS; probe++){
+        int id = (hash + probe) & (LOG_MAX_FORMATS - 1);
+        int ready = SDL_AtomicGet(&log_format_ready[id]);
+
+        if(ready > 0 && log_formats[id].format == format && log_formats[id].line_number == line_number){
+            return id;
+        }
+
+        if(ready == 0){
+            // first time this site has logged, claim the slot
+            SDL_AtomicLock(&log_format_lock);
+            if(SDL_AtomicGet(&log_format_ready[id]) != 0){
+                SDL_AtomicUnlock(&log_format_lock);
+                probe--;
+                continue;
+            }
+
+            LogFormat* entry = &log_formats[id];
+            entry->format = format;
+            entry->file_name = file_name;
+            entry->line_number = line_number;
+            bool usable = parse_format(format, entry);
+
+            // -1 marks a site that always goes the slow way
+            SDL_AtomicSet(&log_format_ready[id], usable ? 1 : -1);
+            SDL_AtomicUnlock(&log_format_lock);
+            return usable ? id : -1;
+        }
+
+        if(ready < 0 && log_formats[id].format == format && log_formats[id].line_number == line_number){
+            return -1;
+        }
+    }
+
+    return -1;
+}
+
+void wake_writer(){
+    if(SDL_AtomicCAS(&log_writer_waiting, 1, 0)){
+        SDL_SemPost(log_wakeup);
+    }
+}
+
+LogRing* get_thread_ring(){
+    if(thread_ring || thread_ring_refused) return thread_ring;
+
+    int index = SDL_AtomicAdd(&log_ring_count, 1);
+    if(index >= LOG_MAX_THREADS){
+        SDL_AtomicAdd(&log_ring_count, -1);
+        thread_ring_refused = true;
+        return NULL;
+    }
+
+    thread_ring = calloc(1, sizeof(LogRing));
+    SDL_AtomicSetPtr((void**)&log_rings[index], thread_ring);
+    return thread_ring;
+}
+
+bool log_async_write(const char* file_name, int line_number, const char* format, va_list args){
+    if(!SDL_AtomicGet(&log_running)) return false;
+
+    int id = format_id(file_name, line_number, format);
+    if(id < 0) return false;
+
+    LogRing* ring = get_thread_ring();
+    if(ring == NULL) return false;
+
+    // gather the arguments first, strings need their length up front
+    LogFormat* entry = &log_formats[id];
+    u64 values[LOG_MAX_ARGS];
+    int string_lengths[LOG_MAX_ARGS];
+    int size = sizeof(LogRecord);
+
+    for(int i = 0; i < entry->arg_count; i++){
+        switch(entry->types[i]){
+            case ARG_INT: values[i] = (u64)va_arg(args, int); break;
+            case ARG_LONG: values[i] = (u64)va_arg(args, long); break;
+            case ARG_LONG_LONG: values[i] = (u64)va_arg(args, long long); break;
+            case ARG_SIZE: values[i] = (u64)va_arg(args, size_t); break;
+            case ARG_POINTER: values[i] = (u64)(size_t)va_arg(args, void*); break;
+            case ARG_DOUBLE: {
+                double value = va_arg(args, double);
+                memcpy(&values[i], &value, sizeof(value));
+            } break;
+            case ARG_STRING: {
+                const char* value = va_arg(args, const char*);
+                if(value == NULL) value = "(null)";
+                size_t length = strlen(value);
+                string_lengths[i] = length < LOG_MAX_STRING ? (int)length : LOG_MAX_STRING;
+                values[i] = (u64)(size_t)value;
+                size += 1 + string_lengths[i];
+                continue;
+            }
+        }
+        size += sizeof(u64);
+    }
+    size = (size + 7) & ~7;
+
+    u32 head = (u32)SDL_AtomicGet(&ring->head);
+    u32 tail = (u32)SDL_AtomicGet(&ring->tail);
+    u32 position = head & LOG_RING_MASK;
+    u32 padding = position + size > LOG_RING_SIZE ? LOG_RING_SIZE - position : 0;
+
+    if(LOG_RING_SIZE - (head - tail) < padding + size){
+        SDL_AtomicAdd(&log_dropped, 1);
+        wake_writer();
+        return true;
+    }
+
+    if(padding){
+        LogRecord* pad = (LogRecord*)&ring->data[position];
+        pad->size = (u16)padding;
+        pad->format = LOG_PADDING;
+        position = 0;
+    }
+
+    LogRecord* record = (LogRecord*)&ring->data[position];
+    record->size = (u16)size;
+    record->format = (u16)id;
+    record->cycle = scheduler_cycles;
+
+    u8* out = (u8*)(record + 1);
+    for(int i = 0; i < entry->arg_count; i++){
+        if(entry->types[i] == ARG_STRING){
+            *out++ = (u8)string_lengths[i];
+            memcpy(out, (const char*)(size_t)values[i], string_lengths[i]);
+            out += string_lengths[i];
+        } else {
+            memcpy(out, &values[i], sizeof(u64));
+            out += sizeof(u64);
+        }
+    }
+
+    SDL_AtomicSet(&ring->head, (int)(head + padding + size));
+    wake_writer();
+    return true;
+}
+
+// literal text between conversions, %% comes out as one %
+void write_literal(const char* text, int length){
+    for(int i = 0; i < length; i++){
+        if(text[i] == '%' && i + 1 < length && text[i + 1] == '%') i++;
+        fputc(text[i], log_file);
+    }
+}
+
+void write_record(const LogRecord* record){
+    const LogFormat* entry = &log_formats[record->format];
+    const u8* in = (const u8*)(record + 1);
+    int written = 0;
+
+    fprintf(log_file, "[%llu] %s:%03d ", record->cycle, entry->file_name, entry->line_number);
+
+    for(int i = 0; i < entry->arg_count; i++){
+        write_literal(entry->format + written, entry->spec_starts[i] - written);
+        written = entry->spec_ends[i];
+
+        const char* spec = entry->specs[i];
+        if(entry->types[i] == ARG_STRING){
+            char value[LOG_MAX_STRING + 1];
+            int length = *in++;
+            memcpy(value, in, length);
+            value[length] = '\0';
+            in += length;
+            fprintf(log_file, spec, value);
+            continue;
+        }
+
+        u64 value;
+        memcpy(&value, in, sizeof(value));
+        in += sizeof(value);
+
+        switch(entry->types[i]){
+            case ARG_INT: fprintf(log_file, spec, (int)value); break;
+            case ARG_LONG: fprintf(log_file, spec, (long)value); break;
+            case ARG_LONG_LONG: fprintf(log_file, spec, (long long)value); break;
+            case ARG_SIZE: fprintf(log_file, spec, (size_t)value); break;
+            case ARG_POINTER: fprintf(log_file, spec, (void*)(size_t)value); break;
+            case ARG_DOUBLE: {
+                double number;
+                memcpy(&number, &value, sizeof(number));
+                fprintf(log_file, spec, number);
+            } break;
+        }
+    }
+
+    write_literal(entry->format + written, (int)strlen(entry->format + written));
+    fputc('\n', log_file);
+}
+
+// drain every ring, returns how many records were written
+int drain_rings(){
+    int written = 0;
+    int count = SDL_AtomicGet(&log_ring_count);
+
+    for(int i = 0; i < count && i < LOG_MAX_THREADS; i++){
+        LogRing* ring = SDL_AtomicGetPtr((void**)&log_rings[i]);
+        if(ring == NULL) continue;
+
+        u32 tail = (u32)SDL_AtomicGet(&ring->tail);
+        u32 head = (u32)SDL_AtomicGet(&ring->head);
+        while(tail != head){
+            const LogRecord* record = (const LogRecord*)&ring->data[tail & LOG_RING_MASK];
+            if(record->format != LOG_PADDING){
+                write_record(record);
+                written++;
+            }
+            tail += record->size;
+        }
+        SDL_AtomicSet(&ring->tail, (int)tail);
+    }
+
+    return written;
+}
+
+int log_writer(void* unused){
+    int reported_drops = 0;
+
+    while(true){
+        bool stopping = SDL_AtomicGet(&log_stopping);
+        int written = drain_rings();
+
+        int dropped = SDL_AtomicGet(&log_dropped);
+        if(dropped != reported_drops){
+            fprintf(log_file, "log: %d records dropped, ring full\n", dropped - reported_drops);
+            reported_drops = dropped;
+        }
+
+        if(written == 0){
+            if(stopping) break;
+            fflush(log_file);
+
+            // say we're going to sleep before the last look, a record
+            // published after it sees the flag and posts
+            SDL_AtomicSet(&log_writer_waiting, 1);
+            if(drain_rings() == 0){
+                SDL_SemWaitTimeout(log_wakeup, LOG_IDLE_MS);
+            }
+            SDL_AtomicSet(&log_writer_waiting, 0);
+        }
+    }
+
+    fflush(log_file);
+    return 0;
+}
+
+bool log_async_init(const char* path){
+    log_file = stdout;
+    if(path){
+        log_file = fopen(path, "w");
+        if(log_file == NULL){
+            printf("Unable to open log file %s\n", path);
+            log_file = stdout;
+            return false;
+        }
+        setvbuf(log_file, NULL, _IOFBF, 1 << 16);
+    }
+
+    log_wakeup = SDL_CreateSemaphore(0);
+    if(log_wakeup == NULL){
+        printf("Unable to create log semaphore: %s\n", SDL_GetError());
+        return false;
+    }
+
+    SDL_AtomicSet(&log_stopping, 0);
+    log_thread = SDL_CreateThread(log_writer, "log writer", NULL);
+    if(log_thread == NULL){
+        printf("Unable to start log writer: %s\n", SDL_GetError());
+        return false;
+    }
+
+    SDL_AtomicSet(&log_running, 1);
+    return true;
+}
+
+void log_async_shutdown(){
+    if(log_thread == NULL) return;
+
+    // anything logged from here on goes straight out
+    SDL_AtomicSet(&log_running, 0);
+    SDL_AtomicSet(&log_stopping, 1);
+    SDL_SemPost(log_wakeup);
+    SDL_WaitThread(log_thread, NULL);
+    log_thread = NULL;
+
+    SDL_DestroySemaphore(log_wakeup);
+    log_wakeup = NULL;
+
+    if(log_file != stdout){
+        fclose(log_file);
+    }
+    log_file = NULL;
+}
+
+int log_async_dropped(){
+    return SDL_AtomicGet(&log_dropped);
+}
@@ -2,36 +2,50 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdbool.h>
 
+#include "breakpoint.h"
 #include "cpu.h"
 #include "memory.h"
 #include "logging.h"
 #include "common.h"
 #include "display.h"
+#include "log_async.h"
+#include "scheduler.h"
+#include "trace.h"
 
+// only used when a record can't go through the async rings
 #define LOG_BUFFER_MAX (256)
-char _log_u8_buffer[LOG_BUFFER_MAX];
+THREAD_LOCAL char _log_u8_buffer[LOG_BUFFER_MAX];
 
 int debug_tick_enabled = 0;
 
 void log_with_file_line(const char* file_name, const int line_number, const char* msg, ...){
    va_list args;
    va_start(args, msg);
-   vsnprintf(_log_u8_buffer, LOG_BUFFER_MAX, msg, args);
+   bool queued = log_async_write(file_name, line_number, msg, args);
    va_end(args);
-   printf("%s:%03d %s\n", file_name, line_number, _log_u8_buffer);
+   if(queued) return;
 
-   // TODO file logging
+   va_start(args, msg);
+   vsnprintf(_log_u8_buffer, LOG_BUFFER_MAX, msg, args);
+   va_end(args);
+   printf("[%llu] %s:%03d %s\n", scheduler_cycles, file_name, line_number, _log_u8_buffer);
 }
 
-void PCLOG(){
-    if(debug_tick_enabled)
-        printf("(0x%02x)\t", cpu_registers.PC);
-}
+// the one trace point, called before the instruction at pc runs
+void trace_instruction(unsigned short pc){
+    u8 opcode = memory[pc];
+    const char* mnemonic = cpu_mnemonics[opcode];
+
+    // both bytes, the second on its own reads like a different instruction
+    if(opcode == 0xcb){
+        u8 cb_opcode = memory[(u16)(pc + 1)];
+        printf("(0x%04x)\t0xcb 0x%02x\t%s\n", pc, cb_opcode, cpu_cb_mnemonics[cb_opcode]);
+        return;
+    }
 
-void OPLOG(unsigned short opcode, const char* memonic){
-    if(debug_tick_enabled)
-        printf("0x%02x\t%s\n", opcode, memonic);
+    printf("(0x%04x)\t0x%02x\t%s\n", pc, opcode, mnemonic ? mnemonic : "UNDEFINED");
 }
 
 void debug_print_registers() {
@@ -50,22 +64,19 @@ void debug_print_registers() {
 }
 
 
-void debug_print_mem(){
-    char s = getchar(); // eat space
-    if (s != ' '){
-        printf("Bad format: 'm ffe1'\n");
-        return;
-    }
-    
-    char opcode_str[4];
-    fgets(opcode_str, 5, stdin);
-    unsigned short addr = (unsigned short)strtol(opcode_str, NULL, 16);
+// args is the rest of the command line, after the 'm'
+void debug_print_mem(const char* args){
+    char* end;
+    unsigned long value = strtoul(args, &end, 16);
+    while(*end == ' ') end++;
 
-    if(!addr){
+    if(end == args || value > 0xffff || (*end != '\n' && *end != '\0')){
         printf("Bad format: 'm ffe1'\n");
         return;
     }
 
+    unsigned short addr = (unsigned short)value;
+
     printf("memory[0x%04x] = 0x%02x\n", addr, memory[addr]);
 }
 
@@ -95,13 +106,59 @@ void debug_print_cartridge_header(){
 }
 
 
+// b lists breakpoints and b <spec> adds one, w/wr/wa <spec> watch for
+// writes/reads/either, k <n> removes one and k on its own all of them
+void debug_breakpoint_command(char command, const char* args){
+    // wr/wa, the suffix has to come straight after the w or "w a000" would
+    // read as an access watch on 000
+    int kinds = BREAKPOINT_EXECUTE;
+    if(command == 'w'){
+        kinds = BREAKPOINT_WRITE;
+        if(*args == 'r') kinds = BREAKPOINT_READ;
+        if(*args == 'a') kinds = BREAKPOINT_READ | BREAKPOINT_WRITE;
+        if(kinds != BREAKPOINT_WRITE) args++;
+    }
+
+    while(*args == ' ') args++;
+    bool empty = *args == '\n' || !*args;
+
+    if(command == 'k'){
+        if(empty){
+            breakpoint_clear();
+        } else if(!breakpoint_remove(atoi(args))){
+            printf("No breakpoint %d\n", atoi(args));
+        }
+        return;
+    }
+
+    if(command == 'b' && empty){
+        breakpoint_list();
+        return;
+    }
+
+    int number = breakpoint_add(kinds, args);
+    if(number >= 0) printf("Breakpoint %d set\n", number);
+}
+
 void debug_break(const char* file_name, const int line_number, const char* function_name){
    int cont = 1;
+   char line[128];
    while(cont){
        printf("\n%s:%d %s\n> ", file_name, line_number, function_name);
-       char c = getchar();
+       if(!fgets(line, sizeof(line), stdin)){
+           // nobody left to type anything
+           running = 0;
+           return;
+       }
+
+       char c = line[0];
        if (c == '\n') continue;
        switch(c){
+           case 'b':
+           case 'w':
+           case 'k':
+               debug_breakpoint_command(c, &line[1]);
+               break;
            case 'd':
                debug_display();
                break;
@@ -113,14 +170,21 @@ void debug_break(const char* file_name, const int line_number, const char* funct
                debug_print_cartridge_header();
                break;
            case 'm':
-               debug_print_mem();
+               debug_print_mem(&line[1]);
                break;
            case 'r':
                debug_print_registers();
                break;
+           case 'x':
+               if(!trace_dump()) printf("No trace, run with --trace <n>\n");
+               break;
            case 't':
+#if TRACE_LEVEL >= 1
                debug_tick_enabled = 1;
                cont = 0;
+#else
+               printf("No stepping in a TRACE_LEVEL 0 build\n");
+#endif
                break;
            case 'c':
                printf("Continue...\n");
@@ -131,8 +195,11 @@ void debug_break(const char* file_name, const int line_number, const char* funct
                break;
        }
 
-       int tmp = getchar();
-       while(tmp != '\n') tmp = getchar(); // consume the rest...
+       // consume the rest of an overlong line
+       if(!strchr(line, '\n')){
+           int tmp = getchar();
+           while(tmp != '\n' && tmp != EOF) tmp = getchar();
+       }
    }
 
 }
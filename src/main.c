@@ -9,23 +9,111 @@
 #include "system.h"
 #include "common.h"
 #include "file.h"
+#include "gdb.h"
 #include "memory.h"
 #include "cpu.h"
+#include "bench.h"
+#include "breakpoint.h"
 #include "logging.h"
+#include "log_async.h"
+#include "options.h"
+#include "callgraph.h"
+#include "profile.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "timeline.h"
+#include "trace.h"
+
+
+// everything that touches emulated state runs on this thread, the main
+// thread only presents frames and pumps SDL events
+int emulate(void* unused){
+    timeline_thread_name("emulation");
+    TIMELINE_BEGIN("cpu slice");
+    stats_frame_begin();
 
+    while(running){
+
+        // a dispatched interrupt takes the place of an instruction
+        if(!(cpu_interrupt_master_enable && cpu_service_interrupts())){
+            TRACE_INSTRUCTION(cpu_registers.PC);
+            TRACE_RECORD();
+#ifdef PROFILE
+            u16 profile_pc = cpu_registers.PC;
+#endif
+            u8 opcode = memory[cpu_registers.PC++];
+            cpu_do_instruction(opcode);
+            cpu_instructions++;
+#ifdef PROFILE
+            profile_instruction(profile_pc, opcode);
+#endif
+        }
+#ifdef PROFILE
+        callgraph_tick(cpu_tick_clock.t);
+#endif
+        
+        cpu_total_clock.m += cpu_tick_clock.m;
+        cpu_total_clock.t += cpu_tick_clock.t;
+
+        scheduler_cycles += cpu_tick_clock.t;
+        if(scheduler_cycles >= scheduler_next_event){
+            scheduler_run();
+        }
+
+        BREAKPOINT_CHECK(cpu_registers.PC);
+
+#ifdef SOUND_LOCKSTEP
+        // reference mode, output must match the lazily synced APU exactly
+        sound_sync();
+#endif
+        DEBUG_TICK();
+    }
 
-int main(){
+    TIMELINE_END("cpu slice");
+
+    // let the presenter know if we stopped from in here (e.g. debugger quit)
+    running = 0;
+    return 0;
+}
+
+int main(int argc, char** argv){
     // http://gbdev.gg8.se/wiki/articles/Gameboy_Bootstrap_ROM#Contents_of_the_ROM 
     // printf("%zu\n", sizeof(memory)); 
     // it looks like we map the cartridge ROM immediately then run bios...?
 
     // TODO command line args for debug mode that will disable audio/graphics and
     // allow breakpoints whilst dumping instructions... - psmith march 9 2017
+    if(!options_parse(argc, argv)) return 1;
+
+    // flushed on every way out of main, including the early error returns
+    if(!log_async_init(options.log_path)) return 1;
+    atexit(log_async_shutdown);
+
+    if(options.bench_mix){
+        return bench_mix() ? 0 : 1;
+    }
+
+    scheduler_init();
     if(!system_init()) return 1;
 
+    if(!timeline_init(options.timeline_path)) return 1;
+    if(!stats_init(options.stats_path, options.stats_interval)) return 1;
+
+    if(options.bench_micro){
+        int ok = bench_micro(emulate);
+        system_shutdown();
+        return ok ? 0 : 1;
+    }
+
+    if(options.trace_entries || options.trace_stream_path){
+        // streaming on its own only needs the ring as a write buffer
+        u32 entries = options.trace_entries ? options.trace_entries : (1 << 16);
+        if(!trace_init(entries, options.trace_dump_path, options.trace_stream_path)) return 1;
+        trace_install_crash_handler();
+    }
+
     // load cartridge into memory
-    const char* cartridge_path = "data/Tetris_World.gb";
-    cartridge = read_binary_file(cartridge_path);
+    cartridge = read_binary_file(options.rom_path);
 
     if(cartridge == NULL)
         return 1;
@@ -42,57 +130,28 @@ int main(){
 
     // point to beginning of boot rom
     cpu_registers.PC = 0;
+
+    for(int i = 0; i < options.breakpoint_count; i++){
+        if(breakpoint_add(options.breakpoint_kinds[i], options.breakpoint_specs[i]) < 0) return 1;
+    }
+    if(!gdb_init(options.gdb_address)) return 1;
     
     debug_print_cartridge_header();
 
     running = 1;
-    while(running){
-
-        if (cpu_interrupt_master_enable){
-            char interrupts = memory[ADDR_INTERRUPT_FLAGS] & memory[ADDR_INTERRUPT_ENABLE];
-
-            if (interrupts & INTERRUPT_VBLANK_BIT){
-                LOG("Interrupt Vblank");
-
-            }
-
-            if (interrupts & INTERRUPT_LCDC_BIT){
-                LOG("Interrupt LCDC");
-
-            }
-
-            if (interrupts & INTERRUPT_TIMER_BIT){
-                LOG("Interrupt Timer");
-            
-            }
-
-            if (interrupts & INTERRUPT_SERIAL_IO_BIT){
-                LOG("Interrupt SerialIO");
-            
-            }
-
-            if (interrupts & INTERRUPT_JOYPAD_BIT){
-                LOG("Interrupt Joypad");
-            
-            }
-        }
-
-        PCLOG();
-        u8 opcode = memory[cpu_registers.PC++];
-        cpu_do_instruction(opcode);
-        
-        cpu_total_clock.m += cpu_tick_clock.m;
-        cpu_total_clock.t += cpu_tick_clock.t;
-
-        if (cpu_registers.PC == 0x00fe){
-            BREAK;
-        }
-
-        system_tick();
-        display_tick(cpu_tick_clock.t);
-        sound_tick(cpu_tick_clock.t);
-        debug_tick();
-    }
+    if(options.bench) bench_begin();
+    if(!system_run(emulate)) return 1;
+    gdb_shutdown();
+    if(options.bench) bench_report();
+    timeline_shutdown();
+    stats_shutdown();
+
+    if(options.trace_entries) trace_dump();
+#ifdef PROFILE
+    profile_write(options.profile_prefix);
+    callgraph_write(options.profile_prefix, options.rom_path);
+#endif
+    trace_shutdown();
 
     printf("\n");
     print_u16_chunks(boot_rom);
@@ -1,25 +1,124 @@
 #include <stdio.h>
  
+#include "breakpoint.h"
 #include "common.h"
+#include "display.h"
+#include "joypad.h"
 #include "memory.h"
+#include "sound.h"
+#include "timer.h"
+
+u8 mem_rom_bank = 1;
+
+u8 mem_read_traps[256] = {[0xff] = MEM_TRAP_IO};
+u8 mem_write_traps[256] = {[0xff] = MEM_TRAP_IO};
+
+// watchpoints only see the 16 bit accesses, they never touch IO
+void mem_watch_u16(u16 addr, int kind){
+    u8* traps = kind == BREAKPOINT_WRITE ? mem_write_traps : mem_read_traps;
+    if(traps[addr >> 8] & MEM_TRAP_WATCH) breakpoint_access(addr, kind);
+    if(traps[(u16)(addr + 1) >> 8] & MEM_TRAP_WATCH) breakpoint_access(addr + 1, kind);
+}
 
 void mem_write_u16(u16 addr, u16 value){
+    if((mem_write_traps[addr >> 8] | mem_write_traps[(u16)(addr + 1) >> 8]) & MEM_TRAP_WATCH){
+        mem_watch_u16(addr, BREAKPOINT_WRITE);
+    }
     memory[addr + 1] = (u8)(value >> 8) & 0x00ff;
     memory[addr] = (u8)(value & 0x00ff);
 }
 
+void mem_write_io(u16 addr, u8 value){
+    // hardware registers that have side effects get handed to their owner
+    switch(addr){
+        case ADDR_JOYPAD_INFO:
+            joypad_write_register(value);
+            break;
+        case ADDR_DIV_REGISTER:
+        case ADDR_TIMER_COUNTER:
+        case ADDR_TIMER_MODULO:
+        case ADDR_TIMER_CONTROL:
+            timer_write_register(addr, value);
+            break;
+        case ADDR_LCD_CONTROL:
+        case ADDR_LCD_STATUS:
+        case ADDR_LCDY_COORD:
+        case ADDR_LCDY_COMPARE:
+            display_write_register(addr, value);
+            break;
+        default:
+            if(addr >= ADDR_NR10 && addr < ADDR_WAVE_RAM + 16){
+                sound_write_register(addr, value);
+                break;
+            }
+
+            memory[addr] = value;
+            break;
+    }
+}
+
+void mem_write_trapped(u16 addr, u8 value){
+    u8 traps = mem_write_traps[addr >> 8];
+    if(traps & MEM_TRAP_WATCH) breakpoint_access(addr, BREAKPOINT_WRITE);
+
+    if(traps & MEM_TRAP_IO){
+        mem_write_io(addr, value);
+    } else {
+        memory[addr] = value;
+    }
+}
+
 void mem_write_u8(u16 addr, u8 value){
     // printf("Writing u8 (0x%02x) to 0x%04x ", value, addr);
+    if(mem_write_traps[addr >> 8]){
+        mem_write_trapped(addr, value);
+        return;
+    }
+
     memory[addr] = value;
 }
 
 u16 mem_read_u16(u16 addr){
+    if((mem_read_traps[addr >> 8] | mem_read_traps[(u16)(addr + 1) >> 8]) & MEM_TRAP_WATCH){
+        mem_watch_u16(addr, BREAKPOINT_READ);
+    }
+
     // note: the gameboy was little endian, so we shift the second byte
     // to the left then add the first byte
     return ( ((u16)memory[addr + 1]) << 8) + memory[addr]; 
 }
 
+u8 mem_read_io(u16 addr){
+    if(addr == ADDR_JOYPAD_INFO){
+        return joypad_read_register();
+    }
+
+    if(addr >= ADDR_DIV_REGISTER && addr <= ADDR_TIMER_CONTROL){
+        return timer_read_register(addr);
+    }
+
+    if(addr >= ADDR_NR10 && addr < ADDR_WAVE_RAM + 16){
+        return sound_read_register(addr);
+    }
+
+    return memory[addr];
+}
+
+u8 mem_read_trapped(u16 addr){
+    u8 traps = mem_read_traps[addr >> 8];
+    if(traps & MEM_TRAP_WATCH) breakpoint_access(addr, BREAKPOINT_READ);
+
+    if(traps & MEM_TRAP_IO){
+        return mem_read_io(addr);
+    }
+    return memory[addr];
+}
+
 u8 mem_read_u8(u16 addr){
+    if(mem_read_traps[addr >> 8]){
+        return mem_read_trapped(addr);
+    }
+
     return memory[addr];
 }
 
@@ -31,10 +130,19 @@ void mem_unset_flag(u16 addr, u8 mask){
     memory[addr] &= ~mask;
 }
 
+// INC/DEC (HL) read and write in place
 void mem_dec_value(u16 addr){
+    if((mem_read_traps[addr >> 8] | mem_write_traps[addr >> 8]) & MEM_TRAP_WATCH){
+        breakpoint_access(addr, BREAKPOINT_READ);
+        breakpoint_access(addr, BREAKPOINT_WRITE);
+    }
     memory[addr]--;
 }
 
 void mem_inc_value(u16 addr){
+    if((mem_read_traps[addr >> 8] | mem_write_traps[addr >> 8]) & MEM_TRAP_WATCH){
+        breakpoint_access(addr, BREAKPOINT_READ);
+        breakpoint_access(addr, BREAKPOINT_WRITE);
+    }
     memory[addr]++;
 }
@@ -0,0 +1,162 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "SDL.h"
+#include "blip.h"
+#include "common.h"
+#include "mixer.h"
+
+void mixer_mix_scalar(const int* lanes, int count, u8 nr51, u8 nr50, int* mixed){
+    // NR51 routes channels to the right (bits 0-3) and left (bits 4-7),
+    // NR50 has the right (bits 0-2) and left (bits 4-6) master volumes
+    int left_volume = ((nr50 >> 4) & 0x07) + 1;
+    int right_volume = (nr50 & 0x07) + 1;
+
+    for(int i = 0; i < count; i++){
+        int left = 0;
+        int right = 0;
+        for(int lane = 0; lane < BLIP_LANES; lane++){
+            int value = lanes[i * BLIP_LANES + lane];
+            if(nr51 & (0x10 << lane)) left += value;
+            if(nr51 & (0x01 << lane)) right += value;
+        }
+
+        mixed[i * 2] = left * left_volume;
+        mixed[i * 2 + 1] = right * right_volume;
+    }
+}
+
+#if defined(__SSE2__) && !defined(__AVX2__)
+// SSE2 has no 32 bit multiply, do the even and odd elements as 64 bit
+// products and keep the low halves (the same for signed and unsigned)
+__m128i mul_low_epi32(__m128i a, __m128i b){
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+#endif
+
+void mixer_mix(const int* lanes, int count, u8 nr51, u8 nr50, int* mixed){
+    int i = 0;
+
+#if defined(__AVX2__)
+    // 8 samples at a time. Two rows per register, transposed within each
+    // 128 bit half so every register holds one lane for samples 0 2 4 6 | 1 3 5 7,
+    // then the panning is just masks and the volume one multiply per side
+    __m256i left_masks[BLIP_LANES];
+    __m256i right_masks[BLIP_LANES];
+    for(int lane = 0; lane < BLIP_LANES; lane++){
+        left_masks[lane] = _mm256_set1_epi32(nr51 & (0x10 << lane) ? -1 : 0);
+        right_masks[lane] = _mm256_set1_epi32(nr51 & (0x01 << lane) ? -1 : 0);
+    }
+    __m256i left_volume = _mm256_set1_epi32(((nr50 >> 4) & 0x07) + 1);
+    __m256i right_volume = _mm256_set1_epi32((nr50 & 0x07) + 1);
+
+    for(; i + 8 <= count; i += 8){
+        const __m256i* rows = (const __m256i*)&lanes[i * BLIP_LANES];
+        __m256i r01 = _mm256_loadu_si256(rows);
+        __m256i r23 = _mm256_loadu_si256(rows + 1);
+        __m256i r45 = _mm256_loadu_si256(rows + 2);
+        __m256i r67 = _mm256_loadu_si256(rows + 3);
+
+        __m256i t0 = _mm256_unpacklo_epi32(r01, r23);
+        __m256i t1 = _mm256_unpacklo_epi32(r45, r67);
+        __m256i t2 = _mm256_unpackhi_epi32(r01, r23);
+        __m256i t3 = _mm256_unpackhi_epi32(r45, r67);
+        __m256i columns[BLIP_LANES] = {
+            _mm256_unpacklo_epi64(t0, t1), _mm256_unpackhi_epi64(t0, t1),
+            _mm256_unpacklo_epi64(t2, t3), _mm256_unpackhi_epi64(t2, t3)
+        };
+
+        __m256i left = _mm256_setzero_si256();
+        __m256i right = _mm256_setzero_si256();
+        for(int lane = 0; lane < BLIP_LANES; lane++){
+            left = _mm256_add_epi32(left, _mm256_and_si256(columns[lane], left_masks[lane]));
+            right = _mm256_add_epi32(right, _mm256_and_si256(columns[lane], right_masks[lane]));
+        }
+        left = _mm256_mullo_epi32(left, left_volume);
+        right = _mm256_mullo_epi32(right, right_volume);
+
+        // pairs come out as 0 2 1 3 and 4 6 5 7, swap the middle quads back
+        __m256i low = _mm256_unpacklo_epi32(left, right);
+        __m256i high = _mm256_unpackhi_epi32(left, right);
+        _mm256_storeu_si256((__m256i*)&mixed[i * 2], _mm256_permute4x64_epi64(low, _MM_SHUFFLE(3, 1, 2, 0)));
+        _mm256_storeu_si256((__m256i*)&mixed[i * 2 + 8], _mm256_permute4x64_epi64(high, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+#elif defined(__SSE2__)
+    // 4 samples at a time, a 4x4 transpose puts one lane per register
+    __m128i left_masks[BLIP_LANES];
+    __m128i right_masks[BLIP_LANES];
+    for(int lane = 0; lane < BLIP_LANES; lane++){
+        left_masks[lane] = _mm_set1_epi32(nr51 & (0x10 << lane) ? -1 : 0);
+        right_masks[lane] = _mm_set1_epi32(nr51 & (0x01 << lane) ? -1 : 0);
+    }
+    __m128i left_volume = _mm_set1_epi32(((nr50 >> 4) & 0x07) + 1);
+    __m128i right_volume = _mm_set1_epi32((nr50 & 0x07) + 1);
+
+    for(; i + 4 <= count; i += 4){
+        const __m128i* rows = (const __m128i*)&lanes[i * BLIP_LANES];
+        __m128i r0 = _mm_loadu_si128(rows);
+        __m128i r1 = _mm_loadu_si128(rows + 1);
+        __m128i r2 = _mm_loadu_si128(rows + 2);
+        __m128i r3 = _mm_loadu_si128(rows + 3);
+
+        __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+        __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+        __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+        __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+        __m128i columns[BLIP_LANES] = {
+            _mm_unpacklo_epi64(t0, t1), _mm_unpackhi_epi64(t0, t1),
+            _mm_unpacklo_epi64(t2, t3), _mm_unpackhi_epi64(t2, t3)
+        };
+
+        __m128i left = _mm_setzero_si128();
+        __m128i right = _mm_setzero_si128();
+        for(int lane = 0; lane < BLIP_LANES; lane++){
+            left = _mm_add_epi32(left, _mm_and_si128(columns[lane], left_masks[lane]));
+            right = _mm_add_epi32(right, _mm_and_si128(columns[lane], right_masks[lane]));
+        }
+        left = mul_low_epi32(left, left_volume);
+        right = mul_low_epi32(right, right_volume);
+
+        _mm_storeu_si128((__m128i*)&mixed[i * 2], _mm_unpacklo_epi32(left, right));
+        _mm_storeu_si128((__m128i*)&mixed[i * 2 + 4], _mm_unpackhi_epi32(left, right));
+    }
+#endif
+
+    mixer_mix_scalar(&lanes[i * BLIP_LANES], count - i, nr51, nr50, &mixed[i * 2]);
+}
+
+Sint16 mixer_clamp(int value){
+    if(value > 32767) return 32767;
+    if(value < -32768) return -32768;
+    return (Sint16)value;
+}
+
+// one pole high pass, 24.8 fixed point. It's recursive so it can't be
+// split across samples, but the two sides are independent chains and are
+// run together so they overlap in the pipeline
+void mixer_high_pass(int* levels, const int* mixed, int count, Sint16* out){
+    int left_level = levels[0];
+    int right_level = levels[1];
+
+    for(int i = 0; i < count; i++){
+        int left = (mixed[i * 2] << 8) - left_level;
+        int right = (mixed[i * 2 + 1] << 8) - right_level;
+        left_level += left >> 9;
+        right_level += right >> 9;
+
+        // 4 channels of +-15 at volume 8 with the blip scaling fill +-30720,
+        // but a full swing from one end to the other overshoots that
+        out[i * 2] = mixer_clamp(left >> 8);
+        out[i * 2 + 1] = mixer_clamp(right >> 8);
+    }
+
+    levels[0] = left_level;
+    levels[1] = right_level;
+}
@@ -0,0 +1,366 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "hash.h"
+#include "movie.h"
+#include "savestate.h"
+#include "timeline.h"
+
+#define MOVIE_MAGIC "CGBM"
+#define MOVIE_END_MAGIC "CGBE"
+#define MOVIE_VERSION (1)
+
+#define MOVIE_HEADER_SIZE (24)
+#define MOVIE_FOOTER_SIZE (16)
+
+#define RECORD_INPUT (0x01)
+#define RECORD_KEYFRAME (0x02)
+
+typedef struct {
+    u32 frame;
+    u64 offset;
+} MovieKeyframe;
+
+typedef enum {
+    MOVIE_NONE,
+    MOVIE_RECORDING,
+    MOVIE_PLAYING
+} MovieMode;
+
+MovieMode movie_mode = MOVIE_NONE;
+FILE* movie_file = NULL;
+int movie_keyframe_interval = 0;
+
+// the current input run, written out when the buttons change
+u8 run_buttons = 0;
+u32 run_frames = 0;
+
+MovieKeyframe* movie_keyframes = NULL;
+int movie_keyframe_count = 0;
+int movie_keyframe_capacity = 0;
+
+// on disk each index entry is the frame then the offset
+#define MOVIE_INDEX_ENTRY_SIZE (12)
+
+// playback ends at the index, or after movie_frames
+u64 movie_index_offset = 0;
+u32 movie_frames = 0;
+bool movie_done = false;
+
+Savestate movie_state;
+
+u64 movie_rom_hash(){
+    return cartridge ? hash_bytes(HASH_OFFSET, cartridge->data, cartridge->size) : 0;
+}
+
+void write_u32(u32 value){
+    u8 bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+    fwrite(bytes, 1, 4, movie_file);
+}
+
+void write_u64(u64 value){
+    write_u32((u32)value);
+    write_u32((u32)(value >> 32));
+}
+
+// 7 bits at a time, high bit set on all but the last byte
+void write_varint(u32 value){
+    while(value >= 0x80){
+        fputc((value & 0x7f) | 0x80, movie_file);
+        value >>= 7;
+    }
+    fputc(value, movie_file);
+}
+
+bool read_u32(u32* value){
+    u8 bytes[4];
+    if(fread(bytes, 1, 4, movie_file) != 4) return false;
+    *value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((u32)bytes[3] << 24);
+    return true;
+}
+
+bool read_u64(u64* value){
+    u32 low, high;
+    if(!read_u32(&low) || !read_u32(&high)) return false;
+    *value = low | ((u64)high << 32);
+    return true;
+}
+
+bool read_varint(u32* value){
+    *value = 0;
+    for(int shift = 0; shift < 32; shift += 7){
+        int byte = fgetc(movie_file);
+        if(byte == EOF) return false;
+        *value |= (u32)(byte & 0x7f) << shift;
+        if(!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+void flush_run(){
+    if(run_frames == 0) return;
+
+    fputc(RECORD_INPUT, movie_file);
+    fputc(run_buttons, movie_file);
+    write_varint(run_frames);
+    run_frames = 0;
+}
+
+void write_keyframe(int frame){
+    TIMELINE_BEGIN("save io");
+    if(!savestate_save(&movie_state)){
+        printf("Unable to save a movie keyframe at frame %d\n", frame);
+        TIMELINE_END("save io");
+        return;
+    }
+
+    if(movie_keyframe_count == movie_keyframe_capacity){
+        movie_keyframe_capacity = movie_keyframe_capacity ? movie_keyframe_capacity * 2 : 64;
+        movie_keyframes = realloc(movie_keyframes, movie_keyframe_capacity * sizeof(MovieKeyframe));
+    }
+
+    // runs never cross a keyframe, playback starts decoding right after one
+    flush_run();
+
+    movie_keyframes[movie_keyframe_count].frame = frame;
+    movie_keyframes[movie_keyframe_count].offset = ftell(movie_file);
+    movie_keyframe_count++;
+
+    fputc(RECORD_KEYFRAME, movie_file);
+    write_u32(frame);
+    write_u32(movie_state.size);
+    fwrite(movie_state.data, 1, movie_state.size, movie_file);
+    TIMELINE_END("save io");
+}
+
+bool movie_record(const char* path, int keyframe_interval){
+    movie_file = fopen(path, "wb");
+    if(movie_file == NULL){
+        printf("Unable to open movie %s for writing\n", path);
+        return false;
+    }
+
+    movie_mode = MOVIE_RECORDING;
+    movie_keyframe_interval = keyframe_interval;
+    movie_frames = 0;
+    run_frames = 0;
+
+    fwrite(MOVIE_MAGIC, 1, 4, movie_file);
+    write_u32(MOVIE_VERSION);
+    write_u32(keyframe_interval);
+    write_u32(0);
+    write_u64(movie_rom_hash());
+
+    // power on state, so playback never depends on what was loaded
+    write_keyframe(0);
+
+    printf("Recording movie to %s\n", path);
+    return true;
+}
+
+bool movie_read_index(){
+    u8 end_magic[4];
+    u32 count;
+    long footer_offset;
+
+    if(fseek(movie_file, -MOVIE_FOOTER_SIZE, SEEK_END) != 0 || (footer_offset = ftell(movie_file)) < 0 ||
+       !read_u64(&movie_index_offset) || !read_u32(&movie_frames) ||
+       fread(end_magic, 1, 4, movie_file) != 4 || memcmp(end_magic, MOVIE_END_MAGIC, 4) != 0){
+        printf("Movie has no index, was the recording closed properly?\n");
+        return false;
+    }
+
+    // the index has to sit between the header and the footer with room
+    // for all of its entries, otherwise count is garbage
+    if(movie_index_offset < MOVIE_HEADER_SIZE || movie_index_offset + 4 > (u64)footer_offset ||
+       fseek(movie_file, (long)movie_index_offset, SEEK_SET) != 0 || !read_u32(&count) || count == 0 ||
+       count > ((u64)footer_offset - movie_index_offset - 4) / MOVIE_INDEX_ENTRY_SIZE){
+        printf("Movie index is damaged\n");
+        return false;
+    }
+
+    movie_keyframes = malloc(count * sizeof(MovieKeyframe));
+    if(movie_keyframes == NULL){
+        printf("Unable to allocate %u movie keyframes\n", count);
+        return false;
+    }
+    movie_keyframe_count = count;
+    for(u32 i = 0; i < count; i++){
+        if(!read_u32(&movie_keyframes[i].frame) || !read_u64(&movie_keyframes[i].offset)){
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool movie_play(const char* path, int start_frame){
+    movie_file = fopen(path, "rb");
+    if(movie_file == NULL){
+        printf("Unable to open movie %s\n", path);
+        return false;
+    }
+
+    u8 magic[4];
+    u32 version, interval, reserved;
+    u64 rom_hash;
+    if(fread(magic, 1, 4, movie_file) != 4 || memcmp(magic, MOVIE_MAGIC, 4) != 0 ||
+       !read_u32(&version) || !read_u32(&interval) || !read_u32(&reserved) || !read_u64(&rom_hash)){
+        printf("%s is not a movie\n", path);
+        return false;
+    }
+
+    if(version != MOVIE_VERSION){
+        printf("Movie is version %d, only %d is supported\n", version, MOVIE_VERSION);
+        return false;
+    }
+
+    if(interval == 0){
+        printf("Movie has no keyframe interval\n");
+        return false;
+    }
+
+    if(rom_hash != movie_rom_hash()){
+        printf("Movie was recorded with a different ROM\n");
+        return false;
+    }
+
+    if(!movie_read_index()) return false;
+
+    if(start_frame < 0 || start_frame > (int)movie_frames){
+        printf("Movie only has frames 0 to %d\n", movie_frames);
+        return false;
+    }
+
+    // keyframes are evenly spaced so the right one is found directly
+    int keyframe = start_frame / interval;
+    if(keyframe >= movie_keyframe_count) keyframe = movie_keyframe_count - 1;
+    MovieKeyframe* entry = &movie_keyframes[keyframe];
+
+    u8 type;
+    u32 frame, size;
+    if(fseek(movie_file, (long)entry->offset, SEEK_SET) != 0 ||
+       fread(&type, 1, 1, movie_file) != 1 || type != RECORD_KEYFRAME ||
+       !read_u32(&frame) || !read_u32(&size) || frame != entry->frame){
+        printf("Movie keyframe %d is damaged\n", keyframe);
+        return false;
+    }
+
+    movie_state.data = malloc(size);
+    movie_state.size = size;
+    movie_state.capacity = size;
+    if(movie_state.data == NULL || fread(movie_state.data, 1, size, movie_file) != size ||
+       !savestate_load(&movie_state)){
+        printf("Unable to load movie keyframe at frame %d\n", frame);
+        return false;
+    }
+
+    movie_mode = MOVIE_PLAYING;
+    movie_keyframe_interval = interval;
+    movie_done = false;
+    run_frames = 0;
+
+    printf("Playing movie %s from frame %d (%d frames)\n", path, frame, movie_frames);
+    return true;
+}
+
+u8 next_recorded_buttons(){
+    while(run_frames == 0){
+        long offset = ftell(movie_file);
+        int type = fgetc(movie_file);
+
+        if(offset < 0 || (u64)offset >= movie_index_offset || type == EOF){
+            movie_done = true;
+            return run_buttons;
+        }
+
+        if(type == RECORD_INPUT){
+            int buttons = fgetc(movie_file);
+            if(buttons == EOF || !read_varint(&run_frames)){
+                movie_done = true;
+                return run_buttons;
+            }
+            run_buttons = (u8)buttons;
+        } else if(type == RECORD_KEYFRAME){
+            // already where that keyframe would put us
+            u32 frame, size;
+            if(!read_u32(&frame) || !read_u32(&size) || fseek(movie_file, size, SEEK_CUR) != 0){
+                movie_done = true;
+                return run_buttons;
+            }
+        } else {
+            printf("Unknown movie record 0x%02x\n", type);
+            movie_done = true;
+            return run_buttons;
+        }
+    }
+
+    run_frames--;
+    return run_buttons;
+}
+
+u8 movie_input(int frame, u8 buttons){
+    switch(movie_mode){
+        case MOVIE_RECORDING:
+            if(buttons != run_buttons || run_frames == 0xffffffff){
+                flush_run();
+                run_buttons = buttons;
+            }
+            run_frames++;
+            movie_frames = frame;
+            return buttons;
+        case MOVIE_PLAYING:
+            buttons = next_recorded_buttons();
+            if(frame >= (int)movie_frames) movie_done = true;
+            return buttons;
+        default:
+            return buttons;
+    }
+}
+
+void movie_end_frame(int frame){
+    if(movie_mode == MOVIE_RECORDING && frame % movie_keyframe_interval == 0){
+        write_keyframe(frame);
+    }
+}
+
+bool movie_playing(){
+    return movie_mode == MOVIE_PLAYING;
+}
+
+bool movie_finished(){
+    return movie_mode == MOVIE_PLAYING && movie_done;
+}
+
+void movie_close(){
+    if(movie_file == NULL) return;
+
+    if(movie_mode == MOVIE_RECORDING){
+        flush_run();
+
+        u64 index_offset = ftell(movie_file);
+        write_u32(movie_keyframe_count);
+        for(int i = 0; i < movie_keyframe_count; i++){
+            write_u32(movie_keyframes[i].frame);
+            write_u64(movie_keyframes[i].offset);
+        }
+
+        write_u64(index_offset);
+        write_u32(movie_frames);
+        fwrite(MOVIE_END_MAGIC, 1, 4, movie_file);
+
+        printf("Recorded %d frames, %d keyframes\n", movie_frames, movie_keyframe_count);
+    }
+
+    fclose(movie_file);
+    movie_file = NULL;
+    movie_mode = MOVIE_NONE;
+
+    free(movie_keyframes);
+    movie_keyframes = NULL;
+    movie_keyframe_count = movie_keyframe_capacity = 0;
+    savestate_free(&movie_state);
+}
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "breakpoint.h"
+#include "options.h"
+
+// a minute of emulated time
+#define BENCH_DEFAULT_FRAMES (3600)
+
+Options options = {
+    .rom_path = "data/Tetris_World.gb",
+    .speed = -1,
+    .keyframe_seconds = 10,
+    .trace_dump_path = "trace.txt",
+    .profile_prefix = "profile",
+    .stats_interval = 1,
+};
+
+void options_usage(const char* program){
+    printf("usage: %s [options]\n", program);
+    printf("  --rom <path>            cartridge to run (default %s)\n", options.rom_path);
+    printf("  --headless              no window or audio device\n");
+    printf("  --frames <n>            quit after n frames\n");
+    printf("  --speed <x>             run at x times real speed (default 1, uncapped headless)\n");
+    printf("  --uncapped              run as fast as possible\n");
+    printf("  --audio-capture <path>  write audio to a .wav or raw PCM file\n");
+    printf("  --audio-hash <path>     write a hash of each frame's audio samples\n");
+    printf("  --record <path>         record input to a movie\n");
+    printf("  --play <path>           play a movie back, quits at its end\n");
+    printf("  --seek <frame>          start movie playback from this frame\n");
+    printf("  --keyframe-interval <s> seconds between movie keyframes (default 10)\n");
+    printf("  --frame-hash <path>     write a hash of the picture and state every frame\n");
+    printf("  --trace <n>             keep the last n instructions for a trace dump\n");
+    printf("  --trace-dump <path>     where the trace is dumped (default %s)\n", options.trace_dump_path);
+    printf("  --trace-stream <path>   write every instruction to a trace file\n");
+    printf("  --profile <prefix>      profile report paths in a PROFILE build (default %s)\n", options.profile_prefix);
+    printf("  --timeline <path>       write a Chrome trace_event timeline for Perfetto\n");
+    printf("  --stats <path>          append performance stats as key=value lines\n");
+    printf("  --stats-interval <s>    seconds between stats lines (default 1)\n");
+    printf("  --break <spec>          stop in the debugger at [bank:]addr [register op value]\n");
+    printf("  --watch <spec>          stop after a write to an address\n");
+    printf("  --rwatch <spec>         stop after a read from an address\n");
+    printf("  --awatch <spec>         stop after a read from or write to an address\n");
+    printf("  --gdb <port>            listen for gdb on a localhost port (or unix:<path>)\n");
+    printf("  --log <path>            write log output to a file\n");
+    printf("  --bench-mix             benchmark the audio mixing kernels and quit\n");
+    printf("  --bench <rom>           time a headless, uncapped run (with --frames, --input)\n");
+    printf("  --bench-micro           time the dispatch loop, renderer, memory and mixer\n");
+    printf("  --bench-json <path>     also write the benchmark results to a file\n");
+    printf("  --input <path>          same as --play\n");
+}
+
+// the breakpoint kinds each flag sets
+int option_breakpoint_kinds(const char* arg){
+    if(strcmp(arg, "--break") == 0) return BREAKPOINT_EXECUTE;
+    if(strcmp(arg, "--watch") == 0) return BREAKPOINT_WRITE;
+    if(strcmp(arg, "--rwatch") == 0) return BREAKPOINT_READ;
+    if(strcmp(arg, "--awatch") == 0) return BREAKPOINT_READ | BREAKPOINT_WRITE;
+    return 0;
+}
+
+// the argument after a flag, NULL (and complain) if there isn't one
+const char* option_value(int argc, char** argv, int* i){
+    if(*i + 1 >= argc){
+        printf("Missing value for %s\n", argv[*i]);
+        return NULL;
+    }
+
+    *i += 1;
+    return argv[*i];
+}
+
+int options_parse(int argc, char** argv){
+    for(int i = 1; i < argc; i++){
+        const char* arg = argv[i];
+        const char* value = NULL;
+
+        if(strcmp(arg, "--headless") == 0){
+            options.headless = true;
+        } else if(strcmp(arg, "--uncapped") == 0){
+            options.speed = 0;
+        } else if(strcmp(arg, "--bench-mix") == 0){
+            options.bench_mix = true;
+        } else if(strcmp(arg, "--bench-micro") == 0){
+            options.bench_micro = true;
+            options.headless = true;
+        } else if(strcmp(arg, "--bench") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            options.bench = true;
+            options.headless = true;
+            options.rom_path = value;
+        } else if(strcmp(arg, "--bench-json") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            options.bench_json_path = value;
+        } else if(strcmp(arg, "--rom") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            options.rom_path = value;
+        } else if(strcmp(arg, "--frames") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            options.frames = atoi(value);
+        } else if(strcmp(arg, "--speed") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            options.speed = atof(value);
+            if(options.speed <= 0){
+                printf("Speed has to be above 0, use --uncapped for no limit\n");
+                return 0;
+            }
+        } else if(strcmp(arg, "--record") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            options.record_path = value;
+        } else if(strcmp(arg, "--play") == 0 || strcmp(arg, "--input") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            options.play_path = value;
+        } else if(strcmp(arg, "--seek") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            options.seek_frame = atoi(value);
+        } else if(strcmp(arg, "--keyframe-interval") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            options.keyframe_seconds = atof(value);
+        } else if(strcmp(arg, "--frame-hash") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            options.frame_hash_path = value;
+        } else if(strcmp(arg, "--trace") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            options.trace_entries = atoi(value);
+            if(options.trace_entries <= 0){
+                printf("Trace has to keep at least one instruction\n");
+                return 0;
+            }
+        } else if(strcmp(arg, "--trace-dump") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            options.trace_dump_path = value;
+        } else if(strcmp(arg, "--trace-stream") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            options.trace_stream_path = value;
+        } else if(strcmp(arg, "--profile") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+#ifndef PROFILE
+            printf("Profiling isn't built in, use ./build_mac.sh profile\n");
+            return 0;
+#endif
+            options.profile_prefix = value;
+        } else if(strcmp(arg, "--timeline") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            options.timeline_path = value;
+        } else if(strcmp(arg, "--stats") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            options.stats_path = value;
+        } else if(strcmp(arg, "--stats-interval") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            options.stats_interval = atof(value);
+        } else if(option_breakpoint_kinds(arg)){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            if(options.breakpoint_count == OPTIONS_MAX_BREAKPOINTS){
+                printf("No more than %d breakpoints on the command line\n", OPTIONS_MAX_BREAKPOINTS);
+                return 0;
+            }
+            options.breakpoint_specs[options.breakpoint_count] = value;
+            options.breakpoint_kinds[options.breakpoint_count] = option_breakpoint_kinds(arg);
+            options.breakpoint_count++;
+        } else if(strcmp(arg, "--gdb") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            options.gdb_address = value;
+        } else if(strcmp(arg, "--log") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            options.log_path = value;
+        } else if(strcmp(arg, "--audio-capture") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            options.audio_capture_path = value;
+        } else if(strcmp(arg, "--audio-hash") == 0){
+            if(!(value = option_value(argc, argv, &i))) return 0;
+            options.audio_hash_path = value;
+        } else {
+            if(strcmp(arg, "--help") != 0) printf("Unknown option %s\n", arg);
+            options_usage(argv[0]);
+            return 0;
+        }
+    }
+
+    if(options.record_path && options.play_path){
+        printf("Can't record and play a movie at the same time\n");
+        return 0;
+    }
+
+    if(options.seek_frame < 0){
+        printf("--seek frame can't be negative\n");
+        return 0;
+    }
+
+    if(options.seek_frame && !options.play_path){
+        printf("--seek needs a movie to --play\n");
+        return 0;
+    }
+
+    // a fixed amount of work so runs can be compared
+    if(options.bench && !options.frames){
+        options.frames = BENCH_DEFAULT_FRAMES;
+    }
+
+    if(options.keyframe_seconds <= 0){
+        printf("Keyframe interval has to be above 0\n");
+        return 0;
+    }
+
+    if(options.stats_interval <= 0){
+        printf("Stats interval has to be above 0\n");
+        return 0;
+    }
+
+    return 1;
+}
@@ -0,0 +1,133 @@
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "SDL.h"
+#include "common.h"
+#include "pacing.h"
+
+// 70224 cycles at 4194304Hz
+#define PACING_FRAME_NS (16742706.0)
+
+#define NS_PER_SECOND (1000000000ULL)
+
+// wake up this long before the deadline and spin the rest, enough to cover
+// the usual scheduler wake up latency. SDL_Delay only has millisecond
+// resolution so gets more
+#if defined(__linux__)
+#define PACING_SPIN_NS (500000ULL)
+#else
+#define PACING_SPIN_NS (2000000ULL)
+#endif
+
+// further behind than this (a stall, a slow host, a debugger) and we stop
+// trying to catch up rather than running flat out until we have
+#define PACING_MAX_LAG_NS (100000000ULL)
+
+double pacing_speed = 1.0;
+u64 pacing_deadline = 0;
+
+u64 pacing_start = 0;
+u64 pacing_frames = 0;
+
+// measured once a second by the emulation thread, read by the presenter
+u64 pacing_window_start = 0;
+int pacing_window_frames = 0;
+SDL_atomic_t pacing_achieved_permille;
+
+u64 pacing_now(){
+#if defined(__linux__)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64)now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+#else
+    return (u64)(SDL_GetPerformanceCounter() * ((double)NS_PER_SECOND / SDL_GetPerformanceFrequency()));
+#endif
+}
+
+void pacing_sleep_until(u64 deadline){
+#if defined(__linux__)
+    // absolute, so however late we got here the wake up is still on time
+    struct timespec until;
+    until.tv_sec = deadline / NS_PER_SECOND;
+    until.tv_nsec = deadline % NS_PER_SECOND;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+#else
+    u64 now = pacing_now();
+    if(deadline > now){
+        SDL_Delay((Uint32)((deadline - now) / 1000000));
+    }
+#endif
+}
+
+void pacing_wait(u64 deadline){
+    if(deadline > PACING_SPIN_NS){
+        pacing_sleep_until(deadline - PACING_SPIN_NS);
+    }
+
+    while(pacing_now() < deadline){
+#ifdef __SSE2__
+        _mm_pause();
+#endif
+    }
+}
+
+void pacing_set_speed(double speed){
+    pacing_speed = speed;
+    pacing_deadline = pacing_now();
+}
+
+void pacing_init(double speed){
+    pacing_start = pacing_now();
+    pacing_frames = 0;
+    pacing_window_start = pacing_start;
+    pacing_window_frames = 0;
+    SDL_AtomicSet(&pacing_achieved_permille, 0);
+
+    pacing_set_speed(speed);
+}
+
+void pacing_frame(){
+    u64 now = pacing_now();
+
+    pacing_frames++;
+    pacing_window_frames++;
+    if(now - pacing_window_start >= NS_PER_SECOND){
+        double speed = pacing_window_frames * PACING_FRAME_NS / (now - pacing_window_start);
+        SDL_AtomicSet(&pacing_achieved_permille, (int)(speed * 1000));
+        pacing_window_start = now;
+        pacing_window_frames = 0;
+    }
+
+    if(pacing_speed <= 0) return;
+
+    // deadlines advance by a whole frame each time so rounding in the
+    // sleep never accumulates into drift
+    pacing_deadline += (u64)(PACING_FRAME_NS / pacing_speed);
+
+    if(now > pacing_deadline + PACING_MAX_LAG_NS){
+        pacing_deadline = now;
+        return;
+    }
+
+    if(now < pacing_deadline){
+        pacing_wait(pacing_deadline);
+    }
+}
+
+double pacing_achieved_speed(){
+    return SDL_AtomicGet(&pacing_achieved_permille) / 1000.0;
+}
+
+void pacing_report(){
+    double seconds = (double)(pacing_now() - pacing_start) / NS_PER_SECOND;
+    if(seconds <= 0) return;
+
+    double emulated = pacing_frames * PACING_FRAME_NS / NS_PER_SECOND;
+    printf("%llu frames in %.2fs, %.1f fps, %.0f%% speed\n",
+           pacing_frames, seconds, pacing_frames / seconds, emulated / seconds * 100);
+}
@@ -0,0 +1,220 @@
+#ifdef PROFILE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "profile.h"
+#include "common.h"
+#include "cpu.h"
+#include "memory.h"
+
+#define PROFILE_BANK_START (0x4000)
+#define PROFILE_BANK_SIZE (0x4000)
+#define PROFILE_HOTTEST (50)
+
+typedef struct {
+    u64 count;
+    u64 cycles;
+} ProfileCounter;
+
+typedef struct {
+    u8 bank;
+    u16 addr;
+    ProfileCounter counter;
+} ProfileAddress;
+
+ProfileCounter profile_opcodes[256];
+ProfileCounter profile_cb_opcodes[256];
+
+// every address outside the switchable bank, reported as bank 0
+ProfileCounter profile_addresses[MEMORY_SIZE];
+
+// one array per switchable bank, allocated the first time it runs code
+ProfileCounter* profile_banks[256];
+
+ProfileCounter* profile_bank(u8 bank){
+    if(!profile_banks[bank]){
+        profile_banks[bank] = calloc(PROFILE_BANK_SIZE, sizeof(ProfileCounter));
+        if(!profile_banks[bank]){
+            printf("Failed to allocate profile counters for bank %d\n", bank);
+            exit(1);
+        }
+    }
+    return profile_banks[bank];
+}
+
+void profile_instruction(u16 pc, u8 opcode){
+    u32 cycles = cpu_tick_clock.t;
+
+    ProfileCounter* counter = &profile_opcodes[opcode];
+    if(opcode == 0xcb) counter = &profile_cb_opcodes[memory[(u16)(pc + 1)]];
+    counter->count++;
+    counter->cycles += cycles;
+
+    if(pc >= PROFILE_BANK_START && pc < PROFILE_BANK_START + PROFILE_BANK_SIZE){
+        counter = &profile_bank(mem_rom_bank)[pc - PROFILE_BANK_START];
+    } else {
+        counter = &profile_addresses[pc];
+    }
+    counter->count++;
+    counter->cycles += cycles;
+}
+
+int profile_compare_addresses(const void* a, const void* b){
+    const ProfileCounter* left = &((const ProfileAddress*)a)->counter;
+    const ProfileCounter* right = &((const ProfileAddress*)b)->counter;
+
+    if(left->cycles != right->cycles) return left->cycles < right->cycles ? 1 : -1;
+    if(left->count != right->count) return left->count < right->count ? 1 : -1;
+    return 0;
+}
+
+// everything that ran, hottest first. Returns how many
+int profile_collect(ProfileAddress** out){
+    int count = 0;
+    for(int addr = 0; addr < MEMORY_SIZE; addr++){
+        if(profile_addresses[addr].count) count++;
+    }
+    for(int bank = 0; bank < 256; bank++){
+        if(!profile_banks[bank]) continue;
+        for(int i = 0; i < PROFILE_BANK_SIZE; i++){
+            if(profile_banks[bank][i].count) count++;
+        }
+    }
+
+    ProfileAddress* addresses = malloc((count ? count : 1) * sizeof(ProfileAddress));
+    if(!addresses) return -1;
+
+    int n = 0;
+    for(int addr = 0; addr < MEMORY_SIZE; addr++){
+        if(!profile_addresses[addr].count) continue;
+        addresses[n++] = (ProfileAddress){0, (u16)addr, profile_addresses[addr]};
+    }
+    for(int bank = 0; bank < 256; bank++){
+        if(!profile_banks[bank]) continue;
+        for(int i = 0; i < PROFILE_BANK_SIZE; i++){
+            if(!profile_banks[bank][i].count) continue;
+            addresses[n++] = (ProfileAddress){(u8)bank, (u16)(PROFILE_BANK_START + i), profile_banks[bank][i]};
+        }
+    }
+
+    qsort(addresses, count, sizeof(ProfileAddress), profile_compare_addresses);
+    *out = addresses;
+    return count;
+}
+
+// disassembles from the cartridge when the bank isn't the one mapped now
+void profile_disassemble(const ProfileAddress* address, char* out, int size){
+    u8 bytes[3];
+    bool banked = address->addr >= PROFILE_BANK_START && address->addr < PROFILE_BANK_START + PROFILE_BANK_SIZE;
+    long offset = (long)address->bank * PROFILE_BANK_SIZE + (address->addr - PROFILE_BANK_START);
+
+    for(int i = 0; i < 3; i++){
+        if(banked && address->bank != mem_rom_bank && cartridge && offset + i < cartridge->size){
+            bytes[i] = cartridge->data[offset + i];
+        } else {
+            bytes[i] = memory[(u16)(address->addr + i)];
+        }
+    }
+
+    cpu_disassemble(bytes, address->addr, out, size);
+}
+
+double profile_percent(u64 part, u64 total){
+    return total ? 100.0 * part / total : 0;
+}
+
+void profile_write_opcodes(FILE* file, const char* title, const ProfileCounter* counters,
+                           const char* const* mnemonics, const char* prefix, u64 total_cycles){
+    // the opcode table is small, a selection sort keeps it in place
+    int order[256];
+    for(int i = 0; i < 256; i++) order[i] = i;
+    for(int i = 0; i < 256; i++){
+        int best = i;
+        for(int j = i + 1; j < 256; j++){
+            if(counters[order[j]].cycles > counters[order[best]].cycles) best = j;
+        }
+        int tmp = order[i]; order[i] = order[best]; order[best] = tmp;
+    }
+
+    fprintf(file, "\n%s\n\n", title);
+    fprintf(file, "%14s %14s %7s %8s  opcode\n", "count", "cycles", "cycles%", "per exec");
+    for(int i = 0; i < 256; i++){
+        const ProfileCounter* counter = &counters[order[i]];
+        if(!counter->count) break;
+
+        const char* mnemonic = mnemonics[order[i]];
+        fprintf(file, "%14llu %14llu %6.2f%% %8.2f  %s%02x %s\n",
+                counter->count, counter->cycles, profile_percent(counter->cycles, total_cycles),
+                (double)counter->cycles / counter->count, prefix, order[i],
+                mnemonic ? mnemonic : "UNDEFINED");
+    }
+}
+
+bool profile_write(const char* prefix){
+    char path[1024];
+    u64 total_count = 0;
+    u64 total_cycles = 0;
+
+    for(int i = 0; i < 256; i++){
+        total_count += profile_opcodes[i].count + profile_cb_opcodes[i].count;
+        total_cycles += profile_opcodes[i].cycles + profile_cb_opcodes[i].cycles;
+    }
+
+    ProfileAddress* addresses = NULL;
+    int address_count = profile_collect(&addresses);
+    if(address_count < 0){
+        printf("Failed to allocate the profile report\n");
+        return false;
+    }
+
+    snprintf(path, sizeof(path), "%s.txt", prefix);
+    FILE* report = fopen(path, "w");
+    if(!report){
+        printf("Failed to open %s for the profile report\n", path);
+        free(addresses);
+        return false;
+    }
+
+    fprintf(report, "%llu instructions, %llu cycles, %d addresses\n",
+            total_count, total_cycles, address_count);
+
+    profile_write_opcodes(report, "Opcodes", profile_opcodes, cpu_mnemonics, "", total_cycles);
+    profile_write_opcodes(report, "CB opcodes", profile_cb_opcodes, cpu_cb_mnemonics, "cb ", total_cycles);
+
+    fprintf(report, "\nHottest addresses\n\n");
+    fprintf(report, "%7s %14s %14s %7s  instruction\n", "address", "count", "cycles", "cycles%");
+    for(int i = 0; i < address_count && i < PROFILE_HOTTEST; i++){
+        char text[64];
+        profile_disassemble(&addresses[i], text, sizeof(text));
+        fprintf(report, "%02x:%04x %14llu %14llu %6.2f%%  %s\n",
+                addresses[i].bank, addresses[i].addr, addresses[i].counter.count,
+                addresses[i].counter.cycles, profile_percent(addresses[i].counter.cycles, total_cycles), text);
+    }
+    fclose(report);
+    printf("Wrote the profile report to %s\n", path);
+
+    snprintf(path, sizeof(path), "%s.flat", prefix);
+    FILE* flat = fopen(path, "w");
+    if(!flat){
+        printf("Failed to open %s for the flat profile\n", path);
+        free(addresses);
+        return false;
+    }
+
+    fprintf(flat, "# bank\taddress\tcount\tcycles\tinstruction\n");
+    for(int i = 0; i < address_count; i++){
+        char text[64];
+        profile_disassemble(&addresses[i], text, sizeof(text));
+        fprintf(flat, "%02x\t%04x\t%llu\t%llu\t%s\n", addresses[i].bank, addresses[i].addr,
+                addresses[i].counter.count, addresses[i].counter.cycles, text);
+    }
+    fclose(flat);
+    printf("Wrote the flat profile to %s\n", path);
+
+    free(addresses);
+    return true;
+}
+
+#endif
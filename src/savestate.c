@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "cpu.h"
+#include "display.h"
+#include "joypad.h"
+#include "memory.h"
+#include "savestate.h"
+#include "scheduler.h"
+#include "sound.h"
+#include "system.h"
+#include "timer.h"
+
+#define SAVESTATE_MAGIC (0x54534743) // "CGST"
+#define SAVESTATE_VERSION (1)
+
+void savestate_field(Savestate* state, void* data, int size){
+    if(state->failed) return;
+
+    if(state->loading){
+        if(state->position + size > state->size){
+            state->failed = true;
+            return;
+        }
+        memcpy(data, state->data + state->position, size);
+    } else {
+        if(state->position + size > state->capacity){
+            int capacity = state->capacity ? state->capacity : 64 * 1024;
+            while(capacity < state->position + size) capacity *= 2;
+
+            u8* grown = realloc(state->data, capacity);
+            if(grown == NULL){
+                state->failed = true;
+                return;
+            }
+            state->data = grown;
+            state->capacity = capacity;
+        }
+        memcpy(state->data + state->position, data, size);
+        state->size = state->position + size;
+    }
+
+    state->position += size;
+}
+
+void cpu_serialize(Savestate* state){
+    SAVESTATE_FIELD(state, cpu_registers);
+    SAVESTATE_FIELD(state, cpu_tick_clock);
+    SAVESTATE_FIELD(state, cpu_total_clock);
+    SAVESTATE_FIELD(state, cpu_interrupt_master_enable);
+    SAVESTATE_FIELD(state, cpu_enable_interrupts_delay);
+}
+
+// the order here is the file format, bump SAVESTATE_VERSION on any change
+void savestate_serialize(Savestate* state){
+    u32 magic = SAVESTATE_MAGIC;
+    u32 version = SAVESTATE_VERSION;
+    SAVESTATE_FIELD(state, magic);
+    SAVESTATE_FIELD(state, version);
+    if(magic != SAVESTATE_MAGIC || version != SAVESTATE_VERSION){
+        printf("Savestate is not version %d\n", SAVESTATE_VERSION);
+        state->failed = true;
+        return;
+    }
+
+    SAVESTATE_FIELD(state, memory);
+    cpu_serialize(state);
+    scheduler_serialize(state);
+    display_serialize(state);
+    sound_serialize(state);
+    timer_serialize(state);
+    joypad_serialize(state);
+    system_serialize(state);
+}
+
+bool savestate_save(Savestate* state){
+    state->position = 0;
+    state->size = 0;
+    state->loading = false;
+    state->failed = false;
+
+    savestate_serialize(state);
+    return !state->failed;
+}
+
+bool savestate_load(Savestate* state){
+    state->position = 0;
+    state->loading = true;
+    state->failed = false;
+
+    savestate_serialize(state);
+    if(!state->failed && state->position != state->size){
+        printf("Savestate has %d bytes left over\n", state->size - state->position);
+        state->failed = true;
+    }
+
+    return !state->failed;
+}
+
+void savestate_free(Savestate* state){
+    free(state->data);
+    memset(state, 0, sizeof(*state));
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+
+#include "SDL.h"
+#include "common.h"
+#include "scheduler.h"
+
+u64 scheduler_cycles = 0;
+u64 scheduler_next_event = EVENT_NEVER;
+u64 scheduler_events = 0;
+
+bool scheduler_timing = false;
+u64 scheduler_event_ticks[EVENT_COUNT];
+
+u64 event_cycles[EVENT_COUNT];
+EventCallback event_callbacks[EVENT_COUNT];
+
+void scheduler_update_next_event(){
+    // a handful of slots, a linear scan is cheaper than keeping a heap
+    scheduler_next_event = EVENT_NEVER;
+    for(int i = 0; i < EVENT_COUNT; i++){
+        if(event_cycles[i] < scheduler_next_event){
+            scheduler_next_event = event_cycles[i];
+        }
+    }
+}
+
+void scheduler_init(){
+    scheduler_cycles = 0;
+    for(int i = 0; i < EVENT_COUNT; i++){
+        event_cycles[i] = EVENT_NEVER;
+    }
+    scheduler_next_event = EVENT_NEVER;
+}
+
+void scheduler_register(EventType type, EventCallback callback){
+    event_callbacks[type] = callback;
+}
+
+void scheduler_schedule(EventType type, u64 cycle){
+    event_cycles[type] = cycle;
+    if(cycle < scheduler_next_event){
+        scheduler_next_event = cycle;
+    } else {
+        scheduler_update_next_event();
+    }
+}
+
+void scheduler_cancel(EventType type){
+    event_cycles[type] = EVENT_NEVER;
+    scheduler_update_next_event();
+}
+
+u64 scheduler_event_cycle(EventType type){
+    return event_cycles[type];
+}
+
+void scheduler_run(){
+    // an instruction can cross several events (e.g. a short PPU mode and
+    // a timer overflow) so keep going until we have caught up
+    while(scheduler_next_event <= scheduler_cycles){
+        int type = 0;
+        for(int i = 1; i < EVENT_COUNT; i++){
+            if(event_cycles[i] < event_cycles[type]){
+                type = i;
+            }
+        }
+
+        u64 due = event_cycles[type];
+        event_cycles[type] = EVENT_NEVER;
+        scheduler_update_next_event();
+        scheduler_events++;
+
+        if(scheduler_timing){
+            u64 start = SDL_GetPerformanceCounter();
+            event_callbacks[type](due);
+            scheduler_event_ticks[type] += SDL_GetPerformanceCounter() - start;
+        } else {
+            event_callbacks[type](due);
+        }
+    }
+}
+
+void scheduler_serialize(Savestate* state){
+    SAVESTATE_FIELD(state, scheduler_cycles);
+    SAVESTATE_FIELD(state, event_cycles);
+    if(state->loading){
+        scheduler_update_next_event();
+    }
+}
@@ -1,90 +1,745 @@
+#include <stdbool.h>
 #include <stdio.h>
-#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "SDL.h"
+#include "blip.h"
+#include "capture.h"
+#include "common.h"
+#include "hash.h"
 #include "memory.h"
+#include "mixer.h"
+#include "options.h"
+#include "scheduler.h"
+#include "sound.h"
+#include "timeline.h"
 
+#define CPU_CLOCK_RATE (4194304)
+
+// the frame sequencer clocks length, sweep and envelope at 512Hz
+#define FRAME_SEQUENCER_CLOCKS (8192)
+
+#define NR52_POWER (0x80)
+#define NRX4_TRIGGER (0x80)
+#define NRX4_LENGTH_ENABLE (0x40)
+
+#define CHANNEL_SQUARE1 (0)
+#define CHANNEL_SQUARE2 (1)
+#define CHANNEL_WAVE (2)
+#define CHANNEL_NOISE (3)
+#define CHANNEL_COUNT (4)
+
+// stereo frames handed from the emulation thread to the audio callback,
+// must be a power of two
+#define SOUND_RING_SIZE (4096)
+#define SOUND_RING_MASK (SOUND_RING_SIZE - 1)
+
+// small device buffers keep latency down (512 frames is ~12ms), rate
+// control below is what stops them running dry
+#define SOUND_DEVICE_SAMPLES (512)
+
+// the ring is steered towards this many buffered frames by nudging the
+// resampling rate at most SOUND_RATE_ADJUST either way
+#define SOUND_TARGET_FILL (2 * SOUND_DEVICE_SAMPLES)
+#define SOUND_RATE_ADJUST (0.005)
+
+// samples are batched up before touching the ring so the atomics are
+// paid once per chunk rather than once per sample
+#define SOUND_CHUNK_SIZE (256)
+
+#define SOUND_SAMPLE_RATE (44100)
+
+typedef struct {
+    Sint16 left;
+    Sint16 right;
+} Sample;
+
+typedef struct {
+    bool enabled;
+    bool dac_enabled;
+
+    int length_counter;
+    bool length_enabled;
+
+    // 11 bit frequency and the T-cycles left until the waveform steps
+    int frequency;
+    int timer;
+
+    // position in the duty cycle (square) or wave ram (wave)
+    int position;
+
+    // volume envelope (square, noise)
+    int volume;
+    int envelope_period;
+    int envelope_timer;
+    bool envelope_increase;
+
+    // channel 1 only
+    bool sweep_enabled;
+    int sweep_shadow;
+    int sweep_timer;
+
+    // channel 4 only
+    u16 lfsr;
+} SoundChannel;
+
+SoundChannel channels[CHANNEL_COUNT];
+
+// how far the APU has been run, in T-cycles
+u64 sound_cycles = 0;
+u64 frame_sequencer_next = FRAME_SEQUENCER_CLOCKS;
+int frame_sequencer_step = 0;
+
+// last amplitude each channel handed to the blip buffer
+int channel_amplitudes[CHANNEL_COUNT];
+
+// DC blocking high pass on the mixed output, left then right, 24.8 fixed point
+int high_pass_levels[2];
+
+// each bit is the output for one of the 8 duty steps
+const u8 square_duty[4] = {0x01, 0x81, 0x87, 0x7e};
+const int noise_divisor[8] = {8, 16, 32, 48, 64, 80, 96, 112};
+const int wave_volume_shift[4] = {4, 0, 1, 2};
+
+// unused and write only bits read back as 1, NR10 (0xff10) to 0xff2f
+const u8 register_read_mask[0x20] = {
+    0x80, 0x3f, 0x00, 0xff, 0xbf,
+    0xff, 0x3f, 0x00, 0xff, 0xbf,
+    0x7f, 0xff, 0x9f, 0xff, 0xbf,
+    0xff, 0xff, 0x00, 0x00, 0xbf,
+    0x00, 0x00, 0x70,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
 
 // audio
 unsigned int sampleFrequency = 0;
 unsigned int audioBufferSize = 0;
-unsigned int outputAudioBufferSize = 0;
+double rate_adjust = 1.0;
+
+// without a device (headless, or it failed to open) samples are still
+// produced for capture and hashing, just never played
+bool sound_device_open = false;
 
-unsigned int freq1 = 1000;
-unsigned int fase1 = 0;
-unsigned int freq2 = 5000;
-unsigned int fase2 = 0;
+// per frame hash of the mixed output
+FILE* sound_hash_file = NULL;
+u64 sound_hash = HASH_OFFSET;
 
-void sound_tick(int clocks){
-    // this will turn it on
-    // SDL_PauseAudio(0);
+Sample chunk[SOUND_CHUNK_SIZE];
+int chunk_lanes[SOUND_CHUNK_SIZE * BLIP_LANES];
+int chunk_mixed[SOUND_CHUNK_SIZE * 2];
+
+// single producer (emulation thread) single consumer (audio callback),
+// each side only ever writes its own index
+Sample ring[SOUND_RING_SIZE];
+SDL_atomic_t ring_head;
+SDL_atomic_t ring_tail;
+
+// bumped by the producer and the callback respectively
+SDL_atomic_t ring_overruns;
+SDL_atomic_t ring_underruns;
+
+void sound_ring_write(const Sample* samples, int count){
+    int head = SDL_AtomicGet(&ring_head);
+    int space = SOUND_RING_SIZE - (head - SDL_AtomicGet(&ring_tail));
+
+    // the callback has fallen behind, drop what doesn't fit
+    if(count > space){
+        count = space;
+        SDL_AtomicAdd(&ring_overruns, 1);
+    }
+
+    int start = head & SOUND_RING_MASK;
+    int first = count < SOUND_RING_SIZE - start ? count : SOUND_RING_SIZE - start;
+    memcpy(&ring[start], samples, first * sizeof(Sample));
+    memcpy(ring, &samples[first], (count - first) * sizeof(Sample));
+
+    // publishing the new head is what makes the samples visible
+    SDL_AtomicSet(&ring_head, head + count);
 }
 
-void example_mixaudio(void *unused, Uint8 *stream, int len) {
+// runs on the audio thread, just copies whatever is ready
+void sound_callback(void* unused, Uint8* stream, int len) {
+    Sample* out = (Sample*)stream;
+    int wanted = len / sizeof(Sample);
+    int tail = SDL_AtomicGet(&ring_tail);
+    int available = SDL_AtomicGet(&ring_head) - tail;
+    int count = wanted < available ? wanted : available;
+
+    int start = tail & SOUND_RING_MASK;
+    int first = count < SOUND_RING_SIZE - start ? count : SOUND_RING_SIZE - start;
+    memcpy(out, &ring[start], first * sizeof(Sample));
+    memcpy(&out[first], ring, (count - first) * sizeof(Sample));
+
+    // ran dry, pad with silence (not counted before the first samples arrive)
+    if(count < wanted){
+        memset(&out[count], 0, (wanted - count) * sizeof(Sample));
+        if(tail > 0) SDL_AtomicAdd(&ring_underruns, 1);
+    }
+
+    SDL_AtomicSet(&ring_tail, tail + count);
+}
 
-    unsigned int bytesPerPeriod1 = sampleFrequency / freq1;
-    unsigned int bytesPerPeriod2 = sampleFrequency / freq2;
+int square_period(SoundChannel* channel){
+    return (2048 - channel->frequency) * 4;
+}
 
-    for (int i=0;i<len;i++) {
-        int channel1 = 150*sin(fase1*6.28/bytesPerPeriod1);
-        int channel2 = 150*sin(fase2*6.28/bytesPerPeriod2);
+int wave_period(SoundChannel* channel){
+    return (2048 - channel->frequency) * 2;
+}
 
-        int outputValue = channel1 + channel2;           // just add the channels
-        if (outputValue > 127) outputValue = 127;        // and clip the result
-        if (outputValue < -128) outputValue = -128;      // this seems a crude method, but works very well
+int noise_period(){
+    u8 nr43 = memory[ADDR_NR43];
+    return noise_divisor[nr43 & 0x07] << (nr43 >> 4);
+}
 
-        stream[i] = outputValue;
+void step_noise(SoundChannel* channel){
+    u16 lfsr = channel->lfsr;
+    u16 feedback = (lfsr ^ (lfsr >> 1)) & 0x01;
+    lfsr = (lfsr >> 1) | (feedback << 14);
 
-        fase1++;
-        fase1 %= bytesPerPeriod1;
-        fase2++;
-        fase2 %= bytesPerPeriod2;
+    // 7 bit mode also feeds back into bit 6
+    if(memory[ADDR_NR43] & 0x08){
+        lfsr = (lfsr & ~0x40) | (feedback << 6);
     }
+
+    channel->lfsr = lfsr;
 }
 
-void sound_shutdown(){
-    SDL_CloseAudio();
+// digital output of a channel, 0-15
+int channel_output(int index){
+    SoundChannel* channel = &channels[index];
+    if(!channel->enabled) return 0;
+
+    switch(index){
+        case CHANNEL_SQUARE1:
+        case CHANNEL_SQUARE2:
+            {
+                u8 duty = memory[index == CHANNEL_SQUARE1 ? ADDR_NR11 : ADDR_NR21] >> 6;
+                return (square_duty[duty] >> channel->position) & 0x01 ? channel->volume : 0;
+            }
+        case CHANNEL_WAVE:
+            {
+                u8 sample = memory[ADDR_WAVE_RAM + channel->position / 2];
+                sample = (channel->position & 0x01) ? sample & 0x0f : sample >> 4;
+                return sample >> wave_volume_shift[(memory[ADDR_NR32] >> 5) & 0x03];
+            }
+        case CHANNEL_NOISE:
+            return (channel->lfsr & 0x01) ? 0 : channel->volume;
+    }
+
+    return 0;
 }
 
-int sound_init(){
-    // setup audio
-    SDL_AudioSpec *desired, *obtained;
+// what the DAC is putting out, 0-15 maps onto -15..15 and off is silent
+int channel_amplitude(int index){
+    if(!channels[index].dac_enabled) return 0;
+    return channel_output(index) * 2 - 15;
+}
 
-    // Allocate a desired SDL_AudioSpec
-    desired = (SDL_AudioSpec *) malloc(sizeof(SDL_AudioSpec));
+// only changes in amplitude cost anything, each one is a single delta
+void update_output(int index, u64 cycle){
+    int amplitude = channel_amplitude(index);
+    if(amplitude != channel_amplitudes[index]){
+        blip_add_delta(index, cycle, amplitude - channel_amplitudes[index]);
+        channel_amplitudes[index] = amplitude;
+    }
+}
+
+void update_outputs(u64 cycle){
+    for(int i = 0; i < CHANNEL_COUNT; i++){
+        update_output(i, cycle);
+    }
+}
 
-    // Allocate space for the obtained SDL_AudioSpec
-    obtained = (SDL_AudioSpec *) malloc(sizeof(SDL_AudioSpec));
+// step a channel's waveform for clocks cycles from sound_cycles, an edge
+// is only recorded where the waveform actually steps
+void run_channel(int index, int clocks){
+    SoundChannel* channel = &channels[index];
+    int elapsed = 0;
 
-    // choose a samplerate and audio-format
-    desired->freq = 44100;
-    desired->format = AUDIO_S8;
+    while(channel->timer <= clocks - elapsed){
+        elapsed += channel->timer;
 
-    // Large audio buffers reduces risk of dropouts but increases response time.
-    desired->samples = 4096;
+        switch(index){
+            case CHANNEL_SQUARE1:
+            case CHANNEL_SQUARE2:
+                channel->position = (channel->position + 1) & 0x07;
+                channel->timer = square_period(channel);
+                break;
+            case CHANNEL_WAVE:
+                channel->position = (channel->position + 1) & 0x1f;
+                channel->timer = wave_period(channel);
+                break;
+            case CHANNEL_NOISE:
+                step_noise(channel);
+                channel->timer = noise_period();
+                break;
+        }
 
-    // Our callback function
-    desired->callback=example_mixaudio;
-    desired->userdata=NULL;
+        update_output(index, sound_cycles + elapsed);
+    }
 
-    desired->channels = 1;
+    channel->timer -= clocks - elapsed;
+}
 
-    // Open the audio device and start playing sound!
-    if ( SDL_OpenAudio(desired, obtained) < 0 ) {
-        fprintf(stderr, "AudioMixer, Unable to open audio: %s\n", SDL_GetError());
-        exit(1);
+void run_channels(u64 until){
+    int clocks = (int)(until - sound_cycles);
+
+    for(int i = 0; i < CHANNEL_COUNT; i++){
+        // stopped channels reload their timer when triggered
+        if(channels[i].enabled){
+            run_channel(i, clocks);
+        }
+    }
+
+    sound_cycles = until;
+}
+
+int sweep_calculate(SoundChannel* channel){
+    u8 nr10 = memory[ADDR_NR10];
+    int delta = channel->sweep_shadow >> (nr10 & 0x07);
+    int frequency = (nr10 & 0x08) ? channel->sweep_shadow - delta : channel->sweep_shadow + delta;
+
+    if(frequency > 2047){
+        channel->enabled = false;
+    }
+
+    return frequency;
+}
+
+void clock_length(){
+    for(int i = 0; i < CHANNEL_COUNT; i++){
+        SoundChannel* channel = &channels[i];
+        if(channel->length_enabled && channel->length_counter > 0){
+            channel->length_counter--;
+            if(channel->length_counter == 0){
+                channel->enabled = false;
+            }
+        }
+    }
+}
+
+void clock_sweep(){
+    SoundChannel* channel = &channels[CHANNEL_SQUARE1];
+    u8 nr10 = memory[ADDR_NR10];
+    int period = (nr10 >> 4) & 0x07;
+
+    if(--channel->sweep_timer > 0) return;
+    channel->sweep_timer = period ? period : 8;
+
+    if(!channel->sweep_enabled || period == 0) return;
+
+    int frequency = sweep_calculate(channel);
+    if(frequency <= 2047 && (nr10 & 0x07)){
+        channel->frequency = frequency;
+        channel->sweep_shadow = frequency;
+        memory[ADDR_NR13] = frequency & 0xff;
+        memory[ADDR_NR14] = (memory[ADDR_NR14] & ~0x07) | (frequency >> 8);
+
+        // overflow is checked a second time with the new frequency
+        sweep_calculate(channel);
+    }
+}
+
+void clock_envelope(){
+    const int envelope_channels[3] = {CHANNEL_SQUARE1, CHANNEL_SQUARE2, CHANNEL_NOISE};
+
+    for(int i = 0; i < 3; i++){
+        SoundChannel* channel = &channels[envelope_channels[i]];
+        if(channel->envelope_period == 0) continue;
+
+        if(--channel->envelope_timer > 0) continue;
+        channel->envelope_timer = channel->envelope_period;
+
+        if(channel->envelope_increase && channel->volume < 15){
+            channel->volume++;
+        } else if(!channel->envelope_increase && channel->volume > 0){
+            channel->volume--;
+        }
+    }
+}
+
+void clock_frame_sequencer(){
+    switch(frame_sequencer_step){
+        case 2:
+        case 6:
+            clock_sweep();
+            clock_length();
+            break;
+        case 0:
+        case 4:
+            clock_length();
+            break;
+        case 7:
+            clock_envelope();
+            break;
+    }
+
+    frame_sequencer_step = (frame_sequencer_step + 1) & 0x07;
+}
+
+void mix_chunk(const int* lanes, int count, Sample* out){
+    mixer_mix(lanes, count, memory[ADDR_NR51], memory[ADDR_NR50], chunk_mixed);
+    mixer_high_pass(high_pass_levels, chunk_mixed, count, (Sint16*)out);
+}
+
+// dynamic rate control, produce a little more when the ring is emptier
+// than we want and a little less when it is fuller, so the audio device and
+// emulation speed never drift far enough apart to under or overrun
+void adjust_rate(){
+    int buffered = SDL_AtomicGet(&ring_head) - SDL_AtomicGet(&ring_tail);
+    double error = (double)(SOUND_TARGET_FILL - buffered) / SOUND_TARGET_FILL;
+    if(error > 1.0) error = 1.0;
+    if(error < -1.0) error = -1.0;
+
+    rate_adjust = 1.0 + error * SOUND_RATE_ADJUST;
+    blip_set_rate(CPU_CLOCK_RATE, sampleFrequency * rate_adjust);
+}
+
+// integrate and mix whatever complete samples we have, then hand them to
+// the device, the capture file and the hash
+void sound_flush(){
+    int available = blip_samples_available(sound_cycles);
+    if(available == 0) return;
+
+    while(available > 0){
+        int count = available < SOUND_CHUNK_SIZE ? available : SOUND_CHUNK_SIZE;
+        TIMELINE_BEGIN("apu mix");
+        blip_read_samples(sound_cycles, count, chunk_lanes);
+        mix_chunk(chunk_lanes, count, chunk);
+        TIMELINE_END("apu mix");
+
+        if(sound_device_open) sound_ring_write(chunk, count);
+        capture_write((const Sint16*)chunk, count);
+        if(sound_hash_file) sound_hash = hash_bytes(sound_hash, chunk, count * sizeof(Sample));
+
+        available -= count;
     }
 
-    audioBufferSize = obtained->samples;
-    sampleFrequency = obtained->freq;
+    // the blip buffer was just rebased to sound_cycles, safe to change rate.
+    // Only the device needs steering, anything else stays at the nominal
+    // rate so captures and hashes are the same from run to run
+    if(sound_device_open) adjust_rate();
+}
+
+// run the APU up to cycle, splitting at frame sequencer clocks so envelope
+// and length changes land between the right edges
+void sound_run(u64 cycle){
+    if(memory[ADDR_NR52] & NR52_POWER){
+        while(frame_sequencer_next <= cycle){
+            run_channels(frame_sequencer_next);
+            frame_sequencer_next += FRAME_SEQUENCER_CLOCKS;
+            clock_frame_sequencer();
+            update_outputs(sound_cycles);
+        }
 
-    // if the format is 16 bit, two bytes are written for every sample
-    if (obtained->format==AUDIO_U16 || obtained->format==AUDIO_S16) {
-        outputAudioBufferSize = 2 * audioBufferSize;
+        run_channels(cycle);
     } else {
-        outputAudioBufferSize = audioBufferSize;
+        sound_cycles = cycle;
     }
 
-    return 1;
+    if(blip_samples_available(sound_cycles) >= SOUND_CHUNK_SIZE){
+        sound_flush();
+    }
+}
+
+// the APU sits idle until something needs it to be up to date: a register
+// access or the next chunk of output being due. Running a span in one go
+// gives exactly the same edges as running it an instruction at a time.
+void sound_sync(){
+    sound_run(scheduler_cycles);
+}
+
+// emulation thread, once per frame. Everything up to the end of the frame
+// is flushed so each hash covers exactly that frame's samples
+void sound_end_frame(int frame){
+    if(sound_hash_file == NULL) return;
+
+    sound_sync();
+    sound_flush();
+
+    fprintf(sound_hash_file, "%d %016llx\n", frame, sound_hash);
+    sound_hash = HASH_OFFSET;
+}
+
+void sound_schedule_chunk(){
+    scheduler_schedule(EVENT_APU, blip_cycle_for_samples(SOUND_CHUNK_SIZE));
+}
+
+void sound_event(u64 cycle){
+    sound_run(cycle);
+    sound_schedule_chunk();
+}
+
+void trigger_channel(SoundChannel* channel, int index){
+    channel->enabled = channel->dac_enabled;
+
+    if(channel->length_counter == 0){
+        channel->length_counter = index == CHANNEL_WAVE ? 256 : 64;
+    }
+
+    switch(index){
+        case CHANNEL_SQUARE1:
+        case CHANNEL_SQUARE2:
+            channel->timer = square_period(channel);
+            break;
+        case CHANNEL_WAVE:
+            channel->timer = wave_period(channel);
+            channel->position = 0;
+            break;
+        case CHANNEL_NOISE:
+            channel->timer = noise_period();
+            channel->lfsr = 0x7fff;
+            break;
+    }
+
+    channel->envelope_timer = channel->envelope_period;
+    channel->volume = memory[index == CHANNEL_SQUARE1 ? ADDR_NR12 : index == CHANNEL_SQUARE2 ? ADDR_NR22 : ADDR_NR42] >> 4;
+
+    if(index == CHANNEL_SQUARE1){
+        u8 nr10 = memory[ADDR_NR10];
+        int period = (nr10 >> 4) & 0x07;
+        channel->sweep_shadow = channel->frequency;
+        channel->sweep_timer = period ? period : 8;
+        channel->sweep_enabled = period || (nr10 & 0x07);
+        if(nr10 & 0x07){
+            sweep_calculate(channel);
+        }
+    }
+}
+
+void write_envelope(int index, u8 value){
+    SoundChannel* channel = &channels[index];
+    channel->volume = value >> 4;
+    channel->envelope_increase = (value & 0x08) != 0;
+    channel->envelope_period = value & 0x07;
+
+    // the top 5 bits all zero turns the DAC (and so the channel) off
+    channel->dac_enabled = (value & 0xf8) != 0;
+    if(!channel->dac_enabled){
+        channel->enabled = false;
+    }
+}
+
+void write_frequency_high(int index, u8 value){
+    SoundChannel* channel = &channels[index];
+    channel->frequency = (channel->frequency & 0xff) | ((value & 0x07) << 8);
+    channel->length_enabled = (value & NRX4_LENGTH_ENABLE) != 0;
+
+    if(value & NRX4_TRIGGER){
+        trigger_channel(channel, index);
+    }
+}
+
+void sound_power_off(){
+    // everything but NR52 and wave ram is cleared and ignores writes
+    memset(&memory[ADDR_NR10], 0, ADDR_NR52 - ADDR_NR10);
+    memset(channels, 0, sizeof(channels));
+    frame_sequencer_step = 0;
+}
+
+void sound_power_on(){
+    frame_sequencer_next = sound_cycles + FRAME_SEQUENCER_CLOCKS;
+}
+
+void sound_write_channel_register(u16 addr, u8 value);
+
+void sound_write_register(u16 addr, u8 value){
+    sound_sync();
+
+    if(addr == ADDR_NR50 || addr == ADDR_NR51){
+        // panning and volume are applied when mixing, get everything
+        // before this write mixed with the old values
+        sound_flush();
+        sound_schedule_chunk();
+    }
+
+    if(addr >= ADDR_WAVE_RAM){
+        memory[addr] = value;
+        update_output(CHANNEL_WAVE, sound_cycles);
+        return;
+    }
+
+    if(addr == ADDR_NR52){
+        bool was_on = memory[ADDR_NR52] & NR52_POWER;
+        memory[ADDR_NR52] = value & NR52_POWER;
+        if(was_on && !(value & NR52_POWER)){
+            sound_power_off();
+        } else if(!was_on && (value & NR52_POWER)){
+            sound_power_on();
+        }
+        update_outputs(sound_cycles);
+        return;
+    }
+
+    if(!(memory[ADDR_NR52] & NR52_POWER)) return;
+
+    memory[addr] = value;
+    sound_write_channel_register(addr, value);
+
+    // any of these can change what a channel is putting out right now
+    update_outputs(sound_cycles);
+}
+
+void sound_write_channel_register(u16 addr, u8 value){
+    switch(addr){
+        case ADDR_NR11:
+            channels[CHANNEL_SQUARE1].length_counter = 64 - (value & 0x3f);
+            break;
+        case ADDR_NR12:
+            write_envelope(CHANNEL_SQUARE1, value);
+            break;
+        case ADDR_NR13:
+            channels[CHANNEL_SQUARE1].frequency = (channels[CHANNEL_SQUARE1].frequency & 0x700) | value;
+            break;
+        case ADDR_NR14:
+            write_frequency_high(CHANNEL_SQUARE1, value);
+            break;
+        case ADDR_NR21:
+            channels[CHANNEL_SQUARE2].length_counter = 64 - (value & 0x3f);
+            break;
+        case ADDR_NR22:
+            write_envelope(CHANNEL_SQUARE2, value);
+            break;
+        case ADDR_NR23:
+            channels[CHANNEL_SQUARE2].frequency = (channels[CHANNEL_SQUARE2].frequency & 0x700) | value;
+            break;
+        case ADDR_NR24:
+            write_frequency_high(CHANNEL_SQUARE2, value);
+            break;
+        case ADDR_NR30:
+            channels[CHANNEL_WAVE].dac_enabled = (value & 0x80) != 0;
+            if(!channels[CHANNEL_WAVE].dac_enabled){
+                channels[CHANNEL_WAVE].enabled = false;
+            }
+            break;
+        case ADDR_NR31:
+            channels[CHANNEL_WAVE].length_counter = 256 - value;
+            break;
+        case ADDR_NR33:
+            channels[CHANNEL_WAVE].frequency = (channels[CHANNEL_WAVE].frequency & 0x700) | value;
+            break;
+        case ADDR_NR34:
+            write_frequency_high(CHANNEL_WAVE, value);
+            break;
+        case ADDR_NR41:
+            channels[CHANNEL_NOISE].length_counter = 64 - (value & 0x3f);
+            break;
+        case ADDR_NR42:
+            write_envelope(CHANNEL_NOISE, value);
+            break;
+        case ADDR_NR44:
+            write_frequency_high(CHANNEL_NOISE, value);
+            break;
+        default:
+            // NR10, NR32, NR43, NR50 and NR51 are read straight from memory
+            break;
+    }
+}
+
+// rate_adjust isn't saved, it follows the audio device not the emulation
+void sound_serialize(Savestate* state){
+    SAVESTATE_FIELD(state, channels);
+    SAVESTATE_FIELD(state, sound_cycles);
+    SAVESTATE_FIELD(state, frame_sequencer_next);
+    SAVESTATE_FIELD(state, frame_sequencer_step);
+    SAVESTATE_FIELD(state, channel_amplitudes);
+    SAVESTATE_FIELD(state, high_pass_levels);
+    blip_serialize(state);
 }
 
+void sound_get_stats(SoundStats* stats){
+    int buffered = SDL_AtomicGet(&ring_head) - SDL_AtomicGet(&ring_tail);
+    stats->underruns = SDL_AtomicGet(&ring_underruns);
+    stats->overruns = SDL_AtomicGet(&ring_overruns);
+    stats->buffered = buffered;
+    stats->latency_ms = sampleFrequency ? (buffered + audioBufferSize) * 1000.0 / sampleFrequency : 0;
+    stats->rate_adjust = rate_adjust;
+}
+
+u8 sound_read_register(u16 addr){
+    if(addr >= ADDR_WAVE_RAM){
+        return memory[addr];
+    }
+
+    sound_sync();
+
+    u8 value = memory[addr];
+    if(addr == ADDR_NR52){
+        // the low bits report which channels are still playing
+        for(int i = 0; i < CHANNEL_COUNT; i++){
+            if(channels[i].enabled) value |= 1 << i;
+        }
+    }
+
+    return value | register_read_mask[addr - ADDR_NR10];
+}
+
+void sound_shutdown(){
+    if(sound_device_open){
+        SDL_CloseAudio();
+        sound_device_open = false;
+    }
+
+    // whatever is left of a partial frame
+    sound_flush();
+    capture_close();
+
+    if(sound_hash_file){
+        fclose(sound_hash_file);
+        sound_hash_file = NULL;
+    }
+}
+
+bool sound_open_device(){
+    SDL_AudioSpec desired;
+    memset(&desired, 0, sizeof(desired));
+
+    desired.freq = SOUND_SAMPLE_RATE;
+    desired.format = AUDIO_S16SYS;
+    desired.channels = 2;
+    desired.samples = SOUND_DEVICE_SAMPLES;
+
+    // Our callback function
+    desired.callback = sound_callback;
+    desired.userdata = NULL;
+
+    // no obtained spec, SDL converts for us if the device wants something else
+    if ( SDL_OpenAudio(&desired, NULL) < 0 ) {
+        fprintf(stderr, "AudioMixer, Unable to open audio: %s\n", SDL_GetError());
+        return false;
+    }
+
+    audioBufferSize = desired.samples;
+    return true;
+}
+
+int sound_init(){
+    sampleFrequency = SOUND_SAMPLE_RATE;
+
+    // carry on silently without a device rather than refusing to run
+    if(!options.headless){
+        sound_device_open = sound_open_device();
+        if(!sound_device_open) printf("No audio device, continuing without sound\n");
+    }
+
+    if(options.audio_capture_path && !capture_open(options.audio_capture_path, sampleFrequency)){
+        return 0;
+    }
+
+    if(options.audio_hash_path){
+        sound_hash_file = fopen(options.audio_hash_path, "w");
+        if(sound_hash_file == NULL){
+            printf("Unable to open audio hash file %s\n", options.audio_hash_path);
+            return 0;
+        }
+    }
+
+    blip_init(CPU_CLOCK_RATE, sampleFrequency);
+    scheduler_register(EVENT_APU, sound_event);
+    sound_schedule_chunk();
+
+    if(sound_device_open) SDL_PauseAudio(0);
+    return 1;
+}
@@ -0,0 +1,163 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "SDL.h"
+#include "common.h"
+#include "cpu.h"
+#include "display.h"
+#include "scheduler.h"
+#include "sound.h"
+#include "stats.h"
+#include "system.h"
+
+// 70224 cycles at 4194304Hz
+#define STATS_FRAME_SECONDS (70224.0 / 4194304.0)
+
+// frame times in 5us steps up to 40ms, anything slower lands in the last one
+#define STATS_BUCKET_US (5)
+#define STATS_BUCKETS (8192)
+
+FILE* stats_file = NULL;
+u64 stats_interval = 0;
+u64 stats_start = 0;
+
+// the interval being collected, emulation thread only
+u64 stats_window_start = 0;
+int stats_window_frame = 0;
+u64 stats_window_instructions = 0;
+u64 stats_window_events = 0;
+u64 stats_frame_start = 0;
+u32 stats_histogram[STATS_BUCKETS];
+u32 stats_histogram_count = 0;
+
+// two snapshots, the writer fills the one not being shown and then bumps
+// the sequence, whose low bit says which is current
+Stats stats_snapshots[2];
+SDL_atomic_t stats_snapshot_sequence;
+
+double stats_percentile(double fraction){
+    if(!stats_histogram_count) return 0;
+
+    u32 wanted = (u32)(fraction * stats_histogram_count + 0.5);
+    if(wanted < 1) wanted = 1;
+
+    u32 seen = 0;
+    for(int i = 0; i < STATS_BUCKETS; i++){
+        seen += stats_histogram[i];
+        if(seen >= wanted) return (i + 1) * STATS_BUCKET_US / 1000.0;
+    }
+    return STATS_BUCKETS * STATS_BUCKET_US / 1000.0;
+}
+
+void stats_write(const Stats* stats){
+    fprintf(stats_file, "time=%.2f frame=%d speed=%.1f fps=%.1f frame_ms_p50=%.3f frame_ms_p99=%.3f "
+            "instructions_per_sec=%.0f events_per_sec=%.0f frames_dropped=%d frames_duplicated=%d "
+            "audio_underruns=%d\n",
+            stats->seconds, stats->frame, stats->speed * 100, stats->fps, stats->frame_ms_p50,
+            stats->frame_ms_p99, stats->instructions_per_second, stats->events_per_second,
+            stats->frames_dropped, stats->frames_duplicated, stats->audio_underruns);
+
+    // whoever is scraping it wants every line as soon as it exists
+    fflush(stats_file);
+}
+
+// sums up the interval so far and starts the next one
+void stats_snapshot(u64 now){
+    double seconds = (double)(now - stats_window_start) / SDL_GetPerformanceFrequency();
+    int frames = frame_count - stats_window_frame;
+    if(seconds <= 0) return;
+
+    int sequence = SDL_AtomicGet(&stats_snapshot_sequence);
+    Stats* stats = &stats_snapshots[(sequence + 1) & 1];
+
+    SoundStats sound;
+    sound_get_stats(&sound);
+
+    stats->seconds = (double)(now - stats_start) / SDL_GetPerformanceFrequency();
+    stats->frame = frame_count;
+    stats->speed = frames * STATS_FRAME_SECONDS / seconds;
+    stats->fps = frames / seconds;
+    stats->frame_ms_p50 = stats_percentile(0.50);
+    stats->frame_ms_p99 = stats_percentile(0.99);
+    stats->instructions_per_second = (cpu_instructions - stats_window_instructions) / seconds;
+    stats->events_per_second = (scheduler_events - stats_window_events) / seconds;
+    stats->frames_dropped = display_frames_dropped();
+    stats->frames_duplicated = display_frames_duplicated();
+    stats->audio_underruns = sound.underruns;
+
+    SDL_AtomicSet(&stats_snapshot_sequence, sequence + 1);
+    if(stats_file) stats_write(stats);
+
+    stats_window_start = now;
+    stats_window_frame = frame_count;
+    stats_window_instructions = cpu_instructions;
+    stats_window_events = scheduler_events;
+    memset(stats_histogram, 0, sizeof(stats_histogram));
+    stats_histogram_count = 0;
+}
+
+bool stats_init(const char* path, double interval){
+    if(path){
+        stats_file = fopen(path, "w");
+        if(!stats_file){
+            printf("Unable to open stats file %s\n", path);
+            return false;
+        }
+    }
+
+    stats_interval = (u64)(interval * SDL_GetPerformanceFrequency());
+    stats_start = SDL_GetPerformanceCounter();
+    stats_window_start = stats_start;
+    stats_window_frame = frame_count;
+    stats_window_instructions = cpu_instructions;
+    stats_window_events = scheduler_events;
+    return true;
+}
+
+void stats_frame_begin(){
+    stats_frame_start = SDL_GetPerformanceCounter();
+}
+
+void stats_frame_end(){
+    u64 now = SDL_GetPerformanceCounter();
+
+    u64 us = (now - stats_frame_start) * 1000000 / SDL_GetPerformanceFrequency();
+    u64 bucket = us / STATS_BUCKET_US;
+    stats_histogram[bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1]++;
+    stats_histogram_count++;
+
+    if(now - stats_window_start >= stats_interval){
+        stats_snapshot(now);
+    }
+}
+
+int stats_sequence(){
+    return SDL_AtomicGet(&stats_snapshot_sequence);
+}
+
+bool stats_get(Stats* out){
+    int sequence;
+    do {
+        sequence = SDL_AtomicGet(&stats_snapshot_sequence);
+        if(!sequence) return false;
+        *out = stats_snapshots[sequence & 1];
+
+        // the next snapshot after ours goes into the other slot, but the one
+        // after that reuses ours, so anything new meanwhile means go again
+    } while(SDL_AtomicGet(&stats_snapshot_sequence) != sequence);
+
+    return true;
+}
+
+// the last part of an interval still makes it into the file
+void stats_shutdown(){
+    if(!stats_file) return;
+
+    if(frame_count > stats_window_frame){
+        stats_snapshot(SDL_GetPerformanceCounter());
+    }
+
+    fclose(stats_file);
+    stats_file = NULL;
+}
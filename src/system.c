@@ -4,28 +4,131 @@
 #include "SDL.h"
 #include "display.h"
 #include "common.h"
+#include "gdb.h"
+#include "cpu.h"
+#include "hash.h"
+#include "joypad.h"
+#include "memory.h"
+#include "movie.h"
+#include "options.h"
+#include "pacing.h"
+#include "scheduler.h"
 #include "sound.h"
+#include "stats.h"
+#include "system.h"
+#include "timeline.h"
+#include "timer.h"
+
+// a DMG frame, kept running whether or not the LCD is on
+#define FRAME_CLOCKS (70224)
+#define FRAMES_PER_SECOND (4194304.0 / FRAME_CLOCKS)
 
 SDL_Event event;
 
+int frame_count = 0;
+
+FILE* frame_hash_file = NULL;
+
+// the picture plus everything from VRAM up and the registers, enough to
+// spot two runs going different ways on the frame it happens
+void write_frame_hash(){
+    u64 state = hash_bytes(HASH_OFFSET, &memory[ADDR_TILE_DATA1], MEMORY_SIZE - ADDR_TILE_DATA1);
+    state = hash_bytes(state, &cpu_registers, sizeof(cpu_registers));
+    fprintf(frame_hash_file, "%d %016llx %016llx\n", frame_count, display_last_frame_hash(), state);
+}
+
+// once per emulated frame on the emulation thread
+void system_frame_event(u64 cycle){
+    // the emulated frame's cpu slice ends here, the host side work isn't part of it
+    TIMELINE_END("cpu slice");
+    TIMELINE_INSTANT("frame");
+    frame_count++;
+    stats_frame_end();
+
+    joypad_latch(movie_input(frame_count, joypad_host_buttons()));
+
+    sound_end_frame(frame_count);
+    if(frame_hash_file) write_frame_hash();
+
+    if(options.frames && frame_count >= options.frames){
+        running = 0;
+    }
+
+    if(movie_finished()){
+        printf("Movie finished at frame %d\n", frame_count);
+        running = 0;
+    }
+
+    scheduler_schedule(EVENT_FRAME, cycle + FRAME_CLOCKS);
+
+    // a new connection or a ctrl-c stops here, between instructions
+    gdb_poll();
+
+    // keyframes want the next frame already scheduled
+    movie_end_frame(frame_count);
+
+    // running up to a seek point goes as fast as it can
+    if(frame_count >= options.seek_frame){
+        TIMELINE_BEGIN("pacing");
+        pacing_frame();
+        TIMELINE_END("pacing");
+    }
+
+    TIMELINE_BEGIN("cpu slice");
+    stats_frame_begin();
+}
+
+void system_serialize(Savestate* state){
+    SAVESTATE_FIELD(state, frame_count);
+}
+
+// keyboard layout, in JOYPAD_* bit order
+const SDL_Scancode joypad_keys[8] = {
+    SDL_SCANCODE_RIGHT, SDL_SCANCODE_LEFT, SDL_SCANCODE_UP, SDL_SCANCODE_DOWN,
+    SDL_SCANCODE_X, SDL_SCANCODE_Z, SDL_SCANCODE_BACKSPACE, SDL_SCANCODE_RETURN
+};
+
+// host input, polled once per refresh by the presenter. The emulation
+// thread never touches SDL events, it just picks up the button mask
 void system_tick(){
+    TIMELINE_BEGIN("input poll");
     while(SDL_PollEvent(&event)){
         if(event.type == SDL_QUIT || event.type == SDL_WINDOWEVENT_CLOSE){
             running = 0;
+            TIMELINE_END("input poll");
             return;
         }
 
+        if(event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_EXPOSED){
+            display_invalidate();
+        }
+
         if(event.type == SDL_KEYDOWN){
             if(event.key.keysym.sym == SDLK_F1){
                 display_cycle_window_mode();
             }
+            if(event.key.keysym.sym == SDLK_F2){
+                display_toggle_hud();
+            }
         }
     }
 
+    const Uint8* keys = SDL_GetKeyboardState(NULL);
+    u8 buttons = 0;
+    for(int i = 0; i < 8; i++){
+        if(keys[joypad_keys[i]]) buttons |= 1 << i;
+    }
+    joypad_set_host_buttons(buttons);
+    TIMELINE_END("input poll");
 }
 
 int system_init(){
-    if( SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_AUDIO ) <0 ) {
+    Uint32 subsystems = SDL_INIT_TIMER;
+    if(!options.headless){
+        subsystems |= SDL_INIT_VIDEO | SDL_INIT_AUDIO;
+    }
+
+    if( SDL_Init(subsystems) <0 ) {
         printf("Unable to init SDL: %s\n", SDL_GetError());
         return 0;
     }
@@ -36,14 +139,72 @@ int system_init(){
     }
     
     if(!sound_init()){
-        printf("Unable to init SDL display: %s\n", SDL_GetError());
+        printf("Unable to init SDL audio: %s\n", SDL_GetError());
+        return 0;
+    }
+
+    timer_init();
+
+    scheduler_register(EVENT_FRAME, system_frame_event);
+    scheduler_schedule(EVENT_FRAME, FRAME_CLOCKS);
+
+    return 1;
+}
+
+int system_run(int (*emulate)(void*)){
+    if(options.play_path && !movie_play(options.play_path, options.seek_frame)){
+        return 0;
+    }
+
+    if(options.record_path){
+        int interval = (int)(options.keyframe_seconds * FRAMES_PER_SECOND + 0.5);
+        if(!movie_record(options.record_path, interval > 0 ? interval : 1)){
+            return 0;
+        }
+    }
+
+    if(options.frame_hash_path){
+        frame_hash_file = fopen(options.frame_hash_path, "w");
+        if(frame_hash_file == NULL){
+            printf("Unable to open frame hash file %s\n", options.frame_hash_path);
+            return 0;
+        }
+    }
+
+    double speed = options.speed;
+    if(speed < 0){
+        speed = options.headless ? 0 : 1;
+    }
+    pacing_init(speed);
+
+    // nothing to present, just emulate on this thread
+    if(options.headless){
+        emulate(NULL);
+        pacing_report();
+        return 1;
+    }
+
+    // emulation gets its own thread so vsync and compositor stalls in
+    // the present loop never hold up the cpu
+    SDL_Thread* emulation_thread = SDL_CreateThread(emulate, "emulation", NULL);
+    if(emulation_thread == NULL){
+        printf("Unable to start emulation thread: %s\n", SDL_GetError());
         return 0;
     }
 
+    display_present_loop();
+    SDL_WaitThread(emulation_thread, NULL);
+    pacing_report();
     return 1;
 }
 
 void system_shutdown(){
+    movie_close();
+    if(frame_hash_file){
+        fclose(frame_hash_file);
+        frame_hash_file = NULL;
+    }
+
     display_shutdown();
     sound_shutdown();
 
@@ -0,0 +1,193 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define TIMELINE_RDTSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TIMELINE_RDTSC
+#endif
+
+#include "SDL.h"
+#include "common.h"
+#include "logging.h"
+#include "timeline.h"
+
+#define TIMELINE_MAX_THREADS (8)
+
+// each thread's events live in chunks that are never moved, so recording
+// only ever touches the thread's own last chunk. 256 chunks of 64K events
+// is 256MB, around a quarter of an hour of a real time session
+#define TIMELINE_CHUNK_EVENTS (64 * 1024)
+#define TIMELINE_MAX_CHUNKS (256)
+
+// the phase rides in the top bits of the timestamp to keep events at 16 bytes
+#define TIMELINE_PHASE_SHIFT (62)
+#define TIMELINE_TICKS_MASK ((1ULL << TIMELINE_PHASE_SHIFT) - 1)
+#define TIMELINE_PHASE_BEGIN (0ULL)
+#define TIMELINE_PHASE_END (1ULL)
+#define TIMELINE_PHASE_INSTANT (2ULL)
+
+typedef struct {
+    u64 ticks;
+    const char* name;
+} TimelineEvent;
+
+typedef struct {
+    const char* name;
+    TimelineEvent* chunks[TIMELINE_MAX_CHUNKS];
+    int chunk_count;
+    int used;
+    bool full;
+} TimelineThread;
+
+bool timeline_enabled = false;
+
+TimelineThread timeline_threads[TIMELINE_MAX_THREADS];
+SDL_atomic_t timeline_thread_count;
+THREAD_LOCAL TimelineThread* timeline_thread = NULL;
+THREAD_LOCAL bool timeline_thread_refused = false;
+
+const char* timeline_path = NULL;
+
+// timestamps are raw TSC reads where there is one, a fraction of the cost of
+// the OS clock, and get mapped onto the performance counter when written out
+u64 timeline_start = 0;
+u64 timeline_start_counter = 0;
+
+u64 timeline_ticks(){
+#ifdef TIMELINE_RDTSC
+    return __rdtsc() & TIMELINE_TICKS_MASK;
+#else
+    return SDL_GetPerformanceCounter() & TIMELINE_TICKS_MASK;
+#endif
+}
+
+// claims a buffer for the calling thread, NULL past TIMELINE_MAX_THREADS
+TimelineThread* timeline_register(){
+    if(timeline_thread_refused) return NULL;
+
+    int index = SDL_AtomicAdd(&timeline_thread_count, 1);
+    if(index >= TIMELINE_MAX_THREADS){
+        timeline_thread_refused = true;
+        return NULL;
+    }
+
+    timeline_thread = &timeline_threads[index];
+    timeline_thread->used = TIMELINE_CHUNK_EVENTS;
+    return timeline_thread;
+}
+
+void timeline_thread_name(const char* name){
+    if(!timeline_enabled) return;
+
+    TimelineThread* thread = timeline_thread ? timeline_thread : timeline_register();
+    if(thread) thread->name = name;
+}
+
+void timeline_event(const char* name, char phase){
+    TimelineThread* thread = timeline_thread;
+    if(!thread && !(thread = timeline_register())) return;
+    if(thread->full) return;
+
+    if(thread->used == TIMELINE_CHUNK_EVENTS){
+        TimelineEvent* chunk = NULL;
+        if(thread->chunk_count < TIMELINE_MAX_CHUNKS){
+            chunk = malloc(TIMELINE_CHUNK_EVENTS * sizeof(TimelineEvent));
+        }
+
+        // stop this thread altogether rather than leave holes in its spans
+        if(!chunk){
+            thread->full = true;
+            return;
+        }
+
+        thread->chunks[thread->chunk_count++] = chunk;
+        thread->used = 0;
+    }
+
+    u64 type = phase == 'B' ? TIMELINE_PHASE_BEGIN : phase == 'E' ? TIMELINE_PHASE_END : TIMELINE_PHASE_INSTANT;
+    TimelineEvent* event = &thread->chunks[thread->chunk_count - 1][thread->used++];
+    event->ticks = timeline_ticks() | (type << TIMELINE_PHASE_SHIFT);
+    event->name = name;
+}
+
+bool timeline_init(const char* path){
+    if(!path) return true;
+
+    // fail now rather than after a long session
+    FILE* file = fopen(path, "w");
+    if(!file){
+        printf("Unable to open timeline %s\n", path);
+        return false;
+    }
+    fclose(file);
+
+    timeline_path = path;
+    timeline_start = timeline_ticks();
+    timeline_start_counter = SDL_GetPerformanceCounter();
+    timeline_enabled = true;
+    timeline_thread_name("main");
+    return true;
+}
+
+void timeline_shutdown(){
+    if(!timeline_path) return;
+    timeline_enabled = false;
+
+    FILE* file = fopen(timeline_path, "w");
+    if(!file){
+        printf("Unable to open timeline %s\n", timeline_path);
+        return;
+    }
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+
+    // the session itself calibrates ticks against the performance counter
+    u64 ticks = timeline_ticks() - timeline_start;
+    u64 counter = SDL_GetPerformanceCounter() - timeline_start_counter;
+    double microseconds = 1e6 / (double)SDL_GetPerformanceFrequency();
+    if(ticks) microseconds *= (double)counter / ticks;
+
+    static const char* const phases[] = {"B", "E", "i"};
+    int thread_count = SDL_AtomicGet(&timeline_thread_count);
+    if(thread_count > TIMELINE_MAX_THREADS) thread_count = TIMELINE_MAX_THREADS;
+    u64 total = 0;
+
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"cgbemu\"}}");
+
+    for(int t = 0; t < thread_count; t++){
+        TimelineThread* thread = &timeline_threads[t];
+        fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                t, thread->name ? thread->name : "thread");
+
+        for(int c = 0; c < thread->chunk_count; c++){
+            int count = c + 1 < thread->chunk_count ? TIMELINE_CHUNK_EVENTS : thread->used;
+            for(int i = 0; i < count; i++){
+                TimelineEvent* event = &thread->chunks[c][i];
+                u64 ticks = event->ticks & TIMELINE_TICKS_MASK;
+                int phase = (int)(event->ticks >> TIMELINE_PHASE_SHIFT);
+
+                fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"%s\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d%s}",
+                        event->name, phases[phase], (ticks - timeline_start) * microseconds, t,
+                        phase == TIMELINE_PHASE_INSTANT ? ", \"s\": \"t\"" : "");
+            }
+            total += count;
+            free(thread->chunks[c]);
+        }
+
+        if(thread->full){
+            printf("Timeline buffer for the %s thread filled up, later events were lost\n",
+                   thread->name ? thread->name : "unnamed");
+        }
+        thread->chunk_count = 0;
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    printf("Wrote %llu timeline events to %s\n", total, timeline_path);
+    timeline_path = NULL;
+}
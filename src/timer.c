@@ -0,0 +1,166 @@
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "common.h"
+#include "memory.h"
+#include "scheduler.h"
+#include "timer.h"
+
+#define TAC_ENABLE (0x04)
+#define TAC_CLOCK_MASK (0x03)
+
+// TIMA reads 0 for this long after overflowing before TMA is loaded
+// and the interrupt is raised
+#define TIMER_RELOAD_DELAY (4)
+
+// TIMA counts falling edges of one bit of the 16 bit internal divider
+// (DIV is its top byte), in T-cycles that bit falls every:
+const int timer_periods[4] = {1024, 16, 64, 256};
+
+// the divider is the number of cycles since it was last reset
+u64 timer_divider_base = 0;
+
+// TIMA as of timer_sync_cycle, 0x100 means it has overflowed and is
+// waiting for the reload at timer_reload_cycle
+int timer_counter = 0;
+u64 timer_sync_cycle = 0;
+u64 timer_reload_cycle = 0;
+
+bool timer_enabled(){
+    return memory[ADDR_TIMER_CONTROL] & TAC_ENABLE;
+}
+
+int timer_period(){
+    return timer_periods[memory[ADDR_TIMER_CONTROL] & TAC_CLOCK_MASK];
+}
+
+u16 timer_divider(u64 cycle){
+    return (u16)(cycle - timer_divider_base);
+}
+
+// the signal TIMA is clocked by, the selected divider bit ANDed with the
+// enable. Anything that makes it fall counts, not just the divider ticking
+bool timer_signal(u64 cycle){
+    return timer_enabled() && (timer_divider(cycle) & (timer_period() / 2));
+}
+
+// falling edges of the selected bit in (from, to]
+u64 timer_edges(u64 from, u64 to){
+    u64 period = timer_period();
+    return (to - timer_divider_base) / period - (from - timer_divider_base) / period;
+}
+
+// bring TIMA up to cycle, it can't pass 0x100 since the reload event is
+// always due before the next edge after an overflow
+void timer_sync(u64 cycle){
+    if(timer_enabled() && timer_counter < 0x100){
+        u64 edges = timer_edges(timer_sync_cycle, cycle);
+        if(edges > (u64)(0x100 - timer_counter)) edges = 0x100 - timer_counter;
+        timer_counter += (int)edges;
+    }
+    timer_sync_cycle = cycle;
+}
+
+void timer_increment(u64 cycle){
+    if(timer_counter >= 0x100) return;
+
+    timer_counter++;
+    if(timer_counter == 0x100){
+        timer_reload_cycle = cycle + TIMER_RELOAD_DELAY;
+    }
+}
+
+// work out when TIMA will next overflow, straight from the divider
+void timer_schedule(){
+    if(timer_counter < 0x100){
+        if(!timer_enabled()){
+            scheduler_cancel(EVENT_TIMER);
+            return;
+        }
+
+        u64 period = timer_period();
+        u64 edges = 0x100 - timer_counter;
+        u64 next = ((timer_sync_cycle - timer_divider_base) / period + edges) * period;
+        timer_reload_cycle = timer_divider_base + next + TIMER_RELOAD_DELAY;
+    }
+
+    scheduler_schedule(EVENT_TIMER, timer_reload_cycle);
+}
+
+void timer_event(u64 cycle){
+    timer_sync(cycle);
+
+    timer_counter = memory[ADDR_TIMER_MODULO];
+    mem_set_flag(ADDR_INTERRUPT_FLAGS, INTERRUPT_TIMER_BIT);
+
+    timer_schedule();
+}
+
+u8 timer_read_register(u16 addr){
+    u64 now = scheduler_cycles;
+
+    switch(addr){
+        case ADDR_DIV_REGISTER:
+            return timer_divider(now) >> 8;
+        case ADDR_TIMER_COUNTER:
+            timer_sync(now);
+            return (u8)timer_counter;
+        case ADDR_TIMER_CONTROL:
+            return memory[addr] | 0xf8;
+        default:
+            return memory[addr];
+    }
+}
+
+void timer_write_register(u16 addr, u8 value){
+    u64 now = scheduler_cycles;
+    timer_sync(now);
+
+    bool signal = timer_signal(now);
+
+    switch(addr){
+        case ADDR_DIV_REGISTER:
+            // any write clears the whole divider, if the selected bit was
+            // set that is a falling edge and TIMA ticks
+            timer_divider_base = now;
+            break;
+        case ADDR_TIMER_COUNTER:
+            // writing during the reload delay cancels the reload and interrupt
+            timer_counter = value;
+            break;
+        case ADDR_TIMER_MODULO:
+            // picked up by a reload that is still pending
+            memory[addr] = value;
+            break;
+        case ADDR_TIMER_CONTROL:
+            // disabling, or switching to a bit that is low, can also drop
+            // the signal and tick TIMA (DMG behaviour)
+            memory[addr] = value & 0x07;
+            break;
+        default:
+            break;
+    }
+
+    if(signal && !timer_signal(now)){
+        timer_increment(now);
+    }
+
+    timer_schedule();
+}
+
+void timer_init(){
+    timer_divider_base = 0;
+    timer_counter = 0;
+    timer_sync_cycle = 0;
+    memory[ADDR_TIMER_MODULO] = 0;
+    memory[ADDR_TIMER_CONTROL] = 0;
+
+    scheduler_register(EVENT_TIMER, timer_event);
+}
+
+void timer_serialize(Savestate* state){
+    SAVESTATE_FIELD(state, timer_divider_base);
+    SAVESTATE_FIELD(state, timer_counter);
+    SAVESTATE_FIELD(state, timer_sync_cycle);
+    SAVESTATE_FIELD(state, timer_reload_cycle);
+}
@@ -0,0 +1,223 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <fcntl.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <sys/stat.h>
+#define trace_open(path) _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE)
+#define trace_write _write
+#define trace_close _close
+#else
+#include <unistd.h>
+#define trace_open(path) open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)
+#define trace_write write
+#define trace_close close
+#endif
+
+#include "trace.h"
+#include "cpu.h"
+#include "memory.h"
+
+// longest line is "A:00 F:00 B:00 C:00 D:00 E:00 H:00 L:00 SP:0000 PC:0000 PCMEM:00,00,00,00\n"
+#define TRACE_LINE_MAX (80)
+
+// lines are formatted into this many at a time before each write
+#define TRACE_WRITE_LINES (256)
+
+TraceEntry* trace_ring = NULL;
+u32 trace_ring_mask = 0;
+u64 trace_position = 0;
+bool trace_enabled = false;
+
+const char* trace_dump_path = NULL;
+
+int trace_stream_fd = -1;
+u64 trace_streamed = 0;
+
+// no stdio in here, the same code runs from the crash handler
+char* trace_hex(char* out, const char* label, unsigned value, int digits){
+    static const char hex[] = "0123456789ABCDEF";
+
+    while(*label) *out++ = *label++;
+    for(int shift = (digits - 1) * 4; shift >= 0; shift -= 4){
+        *out++ = hex[(value >> shift) & 0xf];
+    }
+    return out;
+}
+
+// the gameboy-doctor line for an entry, returns its length
+int trace_format(const TraceEntry* entry, char* out){
+    char* start = out;
+
+    out = trace_hex(out, "A:", entry->A, 2);
+    out = trace_hex(out, " F:", entry->F, 2);
+    out = trace_hex(out, " B:", entry->B, 2);
+    out = trace_hex(out, " C:", entry->C, 2);
+    out = trace_hex(out, " D:", entry->D, 2);
+    out = trace_hex(out, " E:", entry->E, 2);
+    out = trace_hex(out, " H:", entry->H, 2);
+    out = trace_hex(out, " L:", entry->L, 2);
+    out = trace_hex(out, " SP:", entry->SP, 4);
+    out = trace_hex(out, " PC:", entry->PC, 4);
+    out = trace_hex(out, " PCMEM:", entry->pcmem[0], 2);
+    out = trace_hex(out, ",", entry->pcmem[1], 2);
+    out = trace_hex(out, ",", entry->pcmem[2], 2);
+    out = trace_hex(out, ",", entry->pcmem[3], 2);
+    *out++ = '\n';
+
+    return (int)(out - start);
+}
+
+// entries [first, last) of the ring, positions wrap with the ring
+bool trace_write_range(int fd, u64 first, u64 last){
+    char lines[TRACE_LINE_MAX * TRACE_WRITE_LINES];
+
+    while(first != last){
+        int length = 0;
+        for(int i = 0; i < TRACE_WRITE_LINES && first != last; i++, first++){
+            length += trace_format(&trace_ring[first & trace_ring_mask], lines + length);
+        }
+
+        if(trace_write(fd, lines, length) != length) return false;
+    }
+
+    return true;
+}
+
+void trace_stream_flush(){
+    if(trace_stream_fd < 0) return;
+
+    if(!trace_write_range(trace_stream_fd, trace_streamed, trace_position)){
+        printf("Failed writing the instruction trace, stopped streaming\n");
+        trace_close(trace_stream_fd);
+        trace_stream_fd = -1;
+    }
+    trace_streamed = trace_position;
+}
+
+void trace_record(){
+    TraceEntry* entry = &trace_ring[trace_position & trace_ring_mask];
+    u16 pc = cpu_registers.PC;
+
+    entry->A = cpu_registers.A;
+    entry->F = cpu_registers.F;
+    entry->B = cpu_registers.B;
+    entry->C = cpu_registers.C;
+    entry->D = cpu_registers.D;
+    entry->E = cpu_registers.E;
+    entry->H = cpu_registers.H;
+    entry->L = cpu_registers.L;
+    entry->SP = cpu_registers.SP;
+    entry->PC = pc;
+    entry->pcmem[0] = memory[pc];
+    entry->pcmem[1] = memory[(u16)(pc + 1)];
+    entry->pcmem[2] = memory[(u16)(pc + 2)];
+    entry->pcmem[3] = memory[(u16)(pc + 3)];
+
+    trace_position++;
+
+    // streaming empties the whole ring each time it fills
+    if(trace_stream_fd >= 0 && trace_position - trace_streamed > trace_ring_mask){
+        trace_stream_flush();
+    }
+}
+
+// the oldest entry still in the ring
+u64 trace_oldest(){
+    u64 size = (u64)trace_ring_mask + 1;
+    return trace_position > size ? trace_position - size : 0;
+}
+
+bool trace_dump(){
+    if(!trace_ring) return false;
+
+    int fd = trace_open(trace_dump_path);
+    if(fd < 0){
+        printf("Failed to open %s for the instruction trace\n", trace_dump_path);
+        return false;
+    }
+
+    u64 first = trace_oldest();
+    bool ok = trace_write_range(fd, first, trace_position);
+    trace_close(fd);
+
+    if(ok){
+        printf("Wrote the last %llu instructions to %s\n", trace_position - first, trace_dump_path);
+    } else {
+        printf("Failed writing the instruction trace to %s\n", trace_dump_path);
+    }
+    return ok;
+}
+
+void trace_crash(int signal_number){
+    static const char message[] = "\nCrashed, dumping the instruction trace\n";
+
+    // a second crash in here goes straight to the default handler
+    signal(signal_number, SIG_DFL);
+
+    trace_write(2, message, sizeof(message) - 1);
+
+    int fd = trace_open(trace_dump_path);
+    if(fd >= 0){
+        trace_write_range(fd, trace_oldest(), trace_position);
+        trace_close(fd);
+    }
+
+    raise(signal_number);
+}
+
+void trace_install_crash_handler(){
+    if(!trace_ring) return;
+
+    signal(SIGSEGV, trace_crash);
+    signal(SIGABRT, trace_crash);
+    signal(SIGFPE, trace_crash);
+    signal(SIGILL, trace_crash);
+}
+
+bool trace_init(u32 entries, const char* dump_path, const char* stream_path){
+    u32 size = 1;
+    while(size < entries) size <<= 1;
+
+    trace_ring = malloc(size * sizeof(TraceEntry));
+    if(!trace_ring){
+        printf("Failed to allocate %u trace entries\n", size);
+        return false;
+    }
+
+    trace_ring_mask = size - 1;
+    trace_position = 0;
+    trace_streamed = 0;
+    trace_dump_path = dump_path;
+
+    if(stream_path){
+        trace_stream_fd = trace_open(stream_path);
+        if(trace_stream_fd < 0){
+            printf("Failed to open %s for the instruction trace\n", stream_path);
+            free(trace_ring);
+            trace_ring = NULL;
+            return false;
+        }
+    }
+
+    trace_enabled = true;
+    return true;
+}
+
+void trace_shutdown(){
+    if(!trace_ring) return;
+
+    trace_enabled = false;
+
+    if(trace_stream_fd >= 0){
+        trace_stream_flush();
+        if(trace_stream_fd >= 0) trace_close(trace_stream_fd);
+        trace_stream_fd = -1;
+    }
+
+    free(trace_ring);
+    trace_ring = NULL;
+}
@@ -0,0 +1,188 @@
+// cgbemu-tracediff, finds the first line where two gameboy-doctor style
+// instruction traces disagree. Both files are streamed a line at a time so
+// traces of any length can be compared.
+//
+//   cgbemu-tracediff [--context <n>] [--from-pc <hex>] <expected> <actual>
+//
+// Exits 0 when the traces match, 1 at the first difference, 2 on errors.
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINE_MAX_LENGTH (256)
+#define CONTEXT_MAX (64)
+#define READ_BUFFER_SIZE (1 << 20)
+
+typedef struct {
+    const char* path;
+    FILE* file;
+    unsigned long long line_number;
+    char line[LINE_MAX_LENGTH];
+} Trace;
+
+// the lines before a difference, they're the same in both traces
+char context[CONTEXT_MAX][LINE_MAX_LENGTH];
+int context_lines = 3;
+
+bool trace_open(Trace* trace, const char* path){
+    trace->path = path;
+    trace->line_number = 0;
+    trace->file = fopen(path, "rb");
+    if(!trace->file){
+        printf("Failed to open %s\n", path);
+        return false;
+    }
+
+    setvbuf(trace->file, NULL, _IOFBF, READ_BUFFER_SIZE);
+    return true;
+}
+
+// next line without its line ending, false at the end of the file
+bool trace_next(Trace* trace){
+    if(!fgets(trace->line, LINE_MAX_LENGTH, trace->file)) return false;
+    trace->line_number++;
+
+    size_t length = strlen(trace->line);
+    if(length && trace->line[length - 1] != '\n' && !feof(trace->file)){
+        // longer than any trace line, drop the rest
+        int c = fgetc(trace->file);
+        while(c != '\n' && c != EOF) c = fgetc(trace->file);
+    }
+
+    while(length && (trace->line[length - 1] == '\n' || trace->line[length - 1] == '\r')){
+        trace->line[--length] = '\0';
+    }
+    return true;
+}
+
+// skip lines until the first at pc, for lining a trace that includes the boot
+// ROM up with one that starts at the cartridge entry point. Traces write the
+// PC as four uppercase digits, so it's formatted the same way to match
+bool trace_skip_to_pc(Trace* trace, unsigned pc){
+    char field[16];
+    snprintf(field, sizeof(field), "PC:%04X", pc);
+
+    while(trace_next(trace)){
+        if(strstr(trace->line, field)) return true;
+    }
+
+    printf("%s never reaches PC %04X\n", trace->path, pc);
+    return false;
+}
+
+// "A:01 F:B0 ..." fields that differ between the two lines
+void print_field_differences(const char* expected, const char* actual){
+    printf("differs in:");
+
+    while(*expected && *actual){
+        size_t expected_length = strcspn(expected, " ");
+        size_t actual_length = strcspn(actual, " ");
+
+        if(expected_length != actual_length || memcmp(expected, actual, expected_length) != 0){
+            size_t name_length = strcspn(expected, ":");
+            if(name_length > expected_length) name_length = expected_length;
+            printf(" %.*s", (int)name_length, expected);
+        }
+
+        expected += expected_length;
+        actual += actual_length;
+        while(*expected == ' ') expected++;
+        while(*actual == ' ') actual++;
+    }
+
+    if(*expected || *actual) printf(" (line length)");
+    printf("\n");
+}
+
+void print_context(unsigned long long line_number){
+    unsigned long long count = line_number - 1;
+    if(count > (unsigned long long)context_lines) count = context_lines;
+
+    for(unsigned long long i = line_number - count; i < line_number; i++){
+        printf("  %10llu  %s\n", i, context[i % CONTEXT_MAX]);
+    }
+}
+
+void usage(const char* program){
+    printf("usage: %s [--context <n>] [--from-pc <hex>] <expected> <actual>\n", program);
+    printf("  --context <n>    lines shown before the difference (default 3, up to %d)\n", CONTEXT_MAX - 1);
+    printf("  --from-pc <hex>  start comparing both traces at the first instruction at this PC\n");
+}
+
+int main(int argc, char** argv){
+    const char* paths[2] = {NULL, NULL};
+    const char* from_pc = NULL;
+    int path_count = 0;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--context") == 0 && i + 1 < argc){
+            context_lines = atoi(argv[++i]);
+            if(context_lines < 0) context_lines = 0;
+            if(context_lines > CONTEXT_MAX - 1) context_lines = CONTEXT_MAX - 1;
+        } else if(strcmp(argv[i], "--from-pc") == 0 && i + 1 < argc){
+            from_pc = argv[++i];
+        } else if(argv[i][0] != '-' && path_count < 2){
+            paths[path_count++] = argv[i];
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if(path_count != 2){
+        usage(argv[0]);
+        return 2;
+    }
+
+    Trace expected, actual;
+    if(!trace_open(&expected, paths[0])) return 2;
+    if(!trace_open(&actual, paths[1])) return 2;
+
+    // the skipped lines aren't compared, so count from the first one that is
+    unsigned long long line_number = 0;
+    bool have_expected, have_actual;
+    if(from_pc){
+        char* end;
+        unsigned long pc = strtoul(from_pc, &end, 16);
+        if(end == from_pc || *end || pc > 0xffff){
+            printf("--from-pc wants a 16 bit hex address, not %s\n", from_pc);
+            return 2;
+        }
+        if(!trace_skip_to_pc(&expected, (unsigned)pc) || !trace_skip_to_pc(&actual, (unsigned)pc)) return 2;
+        have_expected = have_actual = true;
+    } else {
+        have_expected = trace_next(&expected);
+        have_actual = trace_next(&actual);
+    }
+
+    while(have_expected && have_actual){
+        line_number++;
+
+        if(strcmp(expected.line, actual.line) != 0){
+            printf("First difference at line %llu (%s line %llu, %s line %llu)\n\n",
+                   line_number, expected.path, expected.line_number, actual.path, actual.line_number);
+            print_context(line_number);
+            printf("- %10llu  %s\n", line_number, expected.line);
+            printf("+ %10llu  %s\n\n", line_number, actual.line);
+            print_field_differences(expected.line, actual.line);
+            return 1;
+        }
+
+        memcpy(context[line_number % CONTEXT_MAX], expected.line, LINE_MAX_LENGTH);
+        have_expected = trace_next(&expected);
+        have_actual = trace_next(&actual);
+    }
+
+    if(have_expected || have_actual){
+        Trace* shorter = have_expected ? &actual : &expected;
+        Trace* longer = have_expected ? &expected : &actual;
+        printf("%s ends after %llu matching lines, %s continues\n\n", shorter->path, line_number, longer->path);
+        print_context(line_number + 1);
+        printf("%c %10llu  %s\n", longer == &expected ? '-' : '+', line_number + 1, longer->line);
+        return 1;
+    }
+
+    printf("Traces match, %llu lines\n", line_number);
+    return 0;
+}